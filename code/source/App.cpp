@@ -1,10 +1,17 @@
 /** \file App.cpp */
 #include "App.h"
 #include "Synthesizer.h"
+#include "SoundBank.h"
+#include "Benchmark.h"
 // Tells C++ to invoke command-line main() function even on OS X and Win32.
 G3D_START_AT_MAIN();
 
 int main(int argc, const char* argv[]) {
+    // Headless checks and timings of the CPU-side builders; see Benchmark
+    if (getenv("SUBSTEP_BENCHMARK") != NULL) {
+        return Benchmark::run();
+    }
+
     {
         G3DSpecification g3dSpec;
         g3dSpec.audio = false;
@@ -50,14 +57,8 @@ App::App(const GApp::Settings& settings) : GApp(settings) {
 
 int audioCallback( void * outputBuffer, void * inputBuffer, unsigned int numFrames,
             double streamTime, RtAudioStreamStatus status, void * data ) {
-    size_t numBytes = numFrames * sizeof(Sample);
-    Array<Sample> output;
-    output.resize(numFrames);
-    for (Sample& s : output) {
-        s = 0.0;
-    }
-    Synthesizer::global->synthesize(output);
-    memcpy(outputBuffer, output.getCArray(), numBytes);
+    // The stream is interleaved RTAUDIO_FLOAT32, so mix straight into it
+    Synthesizer::global->synthesize((Sample*)outputBuffer, int(numFrames));
     return 0;
 }
 
@@ -67,44 +68,71 @@ void App::initializeAudio() {
 
   unsigned int bufferByteCount = 0;
   unsigned int bufferFrameCount = 512;
-    
-  // Check for audio devices
-  if( m_rtAudio.getDeviceCount() < 1 ) {
+
+  const char* outputFilename = getenv("SUBSTEP_AUDIO_FILE");
+  if (outputFilename != NULL) {
+    m_audioSettings.outputFilename = outputFilename;
+  }
+  const bool renderToFile = !m_audioSettings.outputFilename.empty();
+  const char* numChannels = getenv("SUBSTEP_AUDIO_CHANNELS");
+  if (numChannels != NULL) {
+    m_audioSettings.numChannels = max(1, atoi(numChannels));
+  }
+
+  // RtAudio falls back to its null device on its own when no API has a
+  // real device, so this only fails if the library was built without it.
+  m_rtAudio = std::make_shared<RtAudio>(renderToFile ? RtAudio::RTAUDIO_DUMMY : RtAudio::UNSPECIFIED);
+  if( m_rtAudio->getDeviceCount() < 1 ) {
     // None :(
     debugPrintf("No audio devices found!\n");
     exit( 1 );
   }
-  RtAudio::DeviceInfo info;
-
-  unsigned int devices = m_rtAudio.getDeviceCount();
-
+  if (m_rtAudio->getCurrentApi() == RtAudio::RTAUDIO_DUMMY && !renderToFile) {
+    debugPrintf("No audio devices found, using the null device\n");
+  }
 
   // Let RtAudio print messages to stderr.
-  m_rtAudio.showWarnings( true );
-
-  // Set input and output parameters
-  RtAudio::StreamParameters iParams, oParams;
-  iParams.deviceId = m_rtAudio.getDefaultInputDevice();
-  iParams.nChannels = m_audioSettings.numChannels;
-  iParams.firstChannel = 0;
-  oParams.deviceId = m_rtAudio.getDefaultOutputDevice();
-  oParams.nChannels = m_audioSettings.numChannels;
+  m_rtAudio->showWarnings( true );
+
+  // Output only: nothing reads the input, and a duplex stream would also
+  // need the input device to support every output channel
+  RtAudio::StreamParameters oParams;
+  oParams.deviceId = renderToFile ? RtApiDummy::NULL_FILE_DEVICE : m_rtAudio->getDefaultOutputDevice();
+  const unsigned int deviceChannels = m_rtAudio->getDeviceInfo(oParams.deviceId).outputChannels;
+  oParams.nChannels = min(unsigned(m_audioSettings.numChannels), max(deviceChannels, 1u));
   oParams.firstChannel = 0;
     
   // Create stream options
   RtAudio::StreamOptions options;
+  options.streamName = m_audioSettings.outputFilename.c_str();
 
-  g_currentAudioBuffer.resize(bufferFrameCount);
   try {
     // Open a stream
-    m_rtAudio.openStream( &oParams, &iParams, m_audioSettings.rtAudioFormat, m_audioSettings.sampleRate, &bufferFrameCount, &audioCallback, (void *)&bufferByteCount, &options );
+    m_rtAudio->openStream( &oParams, NULL, m_audioSettings.rtAudioFormat, m_audioSettings.sampleRate, &bufferFrameCount, &audioCallback, (void *)&bufferByteCount, &options );
   } catch( RtAudioError& e ) {
     // Failed to open stream
     std::cout << e.getMessage() << std::endl;
     exit( 1 );
   }
-  g_currentAudioBuffer.resize(bufferFrameCount);
-  m_rtAudio.startStream();
+  Synthesizer::global->setSampleRate(m_rtAudio->getStreamSampleRate());
+  Synthesizer::global->setChannelCount(oParams.nChannels);
+  // openStream may have changed it to what the device supports
+  Synthesizer::global->setBufferFrameCount(int(bufferFrameCount));
+  // Only worth it for very dense grids; see Synthesizer::setMixThreadCount
+  const char* mixThreads = getenv("SUBSTEP_MIX_THREADS");
+  if (mixThreads != NULL) {
+    Synthesizer::global->setMixThreadCount(clamp(atoi(mixThreads), 1, 64));
+  }
+  // A WAV impulse response, convolved with the mix ahead of the master bus
+  const char* reverbFilename = getenv("SUBSTEP_REVERB_IR");
+  if (reverbFilename != NULL) {
+    const shared_ptr<ConvolutionReverb> reverb = ConvolutionReverb::fromWAV(reverbFilename, m_rtAudio->getStreamSampleRate());
+    if (isNull(reverb)) {
+      debugPrintf("Could not load the impulse response %s\n", reverbFilename);
+    }
+    Synthesizer::global->setReverb(reverb);
+  }
+  m_rtAudio->startStream();
 
 }
 
@@ -124,8 +152,15 @@ void App::onInit() {
     m_rainbowMode = true;
     setFrameDuration(1.0f / 60.0f);
     m_showHelp = true;
+    m_showSpectrum = false;
     m_guiFont = GFont::fromFile(System::findDataFile("console.fnt"));
     initializeAudio();
+
+    const char* soundCacheFilename = getenv("SUBSTEP_SOUND_CACHE");
+    if (soundCacheFilename != NULL) {
+        m_soundCacheFilename = soundCacheFilename;
+        SoundBank::loadCache(m_soundCacheFilename);
+    }
     
     loadGrid();
     // Call setScene(shared_ptr<Scene>()) or setScene(MyScene::create()) to replace
@@ -158,6 +193,39 @@ void App::makeGUI() {
         infoPane->addButton("Pause", [this]() { m_automata.setPaused(!m_automata.paused()); });
         infoPane->addNumberBox("BPM", &m_automata.m_bpm, "", GuiTheme::LINEAR_SLIDER, 30, 300);
         infoPane->addEnumClassRadioButtons("Display Mode", &m_automata.m_displayMode);
+        infoPane->addEnumClassRadioButtons("Edges", &m_automata.m_edges);
+        infoPane->addEnumClassRadioButtons("Lattice", &m_automata.m_lattice);
+        infoPane->addEnumClassRadioButtons("Voice", &m_automata.m_voiceType);
+        infoPane->addEnumClassRadioButtons("Scale", &m_automata.m_scale);
+    } infoPane->endRow();
+    infoPane->beginRow(); {
+        infoPane->addEnumClassRadioButtons("Rows",    &m_automata.m_rowTimbre);
+        infoPane->addEnumClassRadioButtons("Columns", &m_automata.m_columnTimbre);
+    } infoPane->endRow();
+    infoPane->beginRow(); {
+        Envelope& envelope = m_automata.m_noteEnvelope;
+        infoPane->addNumberBox("Attack",  &envelope.attackTime,   "s", GuiTheme::LINEAR_SLIDER, 0.0f, 1.0f);
+        infoPane->addNumberBox("Decay",   &envelope.decayTime,    "s", GuiTheme::LINEAR_SLIDER, 0.0f, 1.0f);
+        infoPane->addNumberBox("Sustain", &envelope.sustainLevel, "",  GuiTheme::LINEAR_SLIDER, 0.0f, 1.0f);
+        infoPane->addNumberBox("Release", &envelope.releaseTime,  "s", GuiTheme::LINEAR_SLIDER, 0.0f, 2.0f);
+        infoPane->addNumberBox("Gate",    &envelope.gateTime,     "s", GuiTheme::LINEAR_SLIDER, 0.0f, 1.0f);
+        infoPane->addEnumClassRadioButtons("Curve", &envelope.curve);
+    } infoPane->endRow();
+    infoPane->beginRow(); {
+        MasterBus* bus = &Synthesizer::global->masterBus();
+        infoPane->addNumberBox("Master", Pointer<float>(bus, &MasterBus::gain, &MasterBus::setGain), "", GuiTheme::LOG_SLIDER, 0.01f, 4.0f);
+        infoPane->addCheckBox("Soft Clip", Pointer<bool>(bus, &MasterBus::softClip, &MasterBus::setSoftClip));
+        const shared_ptr<ConvolutionReverb>& reverb = Synthesizer::global->reverb();
+        if (notNull(reverb)) {
+            infoPane->addNumberBox("Reverb", Pointer<float>(reverb.get(), &ConvolutionReverb::wet, &ConvolutionReverb::setWet), "", GuiTheme::LINEAR_SLIDER, 0.0f, 1.0f);
+        }
+        infoPane->addCheckBox("Spectrum", &m_showSpectrum);
+    } infoPane->endRow();
+    infoPane->beginRow(); {
+        TempoDelay* delay = &Synthesizer::global->delay();
+        infoPane->addNumberBox("Echo",     Pointer<float>(delay, &TempoDelay::wet,      &TempoDelay::setWet),      "", GuiTheme::LINEAR_SLIDER, 0.0f, 1.0f);
+        infoPane->addNumberBox("Feedback", Pointer<float>(delay, &TempoDelay::feedback, &TempoDelay::setFeedback), "", GuiTheme::LINEAR_SLIDER, 0.0f, 0.95f);
+        infoPane->addNumberBox("Steps",    Pointer<float>(delay, &TempoDelay::steps,    &TempoDelay::setSteps),    "", GuiTheme::LINEAR_SLIDER, 0.5f, float(TempoDelay::MAX_STEPS), 0.5f);
     } infoPane->endRow();
     // Example of how to add debugging controls
     infoPane->pack();
@@ -172,6 +240,11 @@ void App::makeGUI() {
     debugWindow->setRect(Rect2D::xywh(0, 0, (float)window()->width(), debugWindow->rect().height()));
 }
 
+/** Clamped to -100 dB for silence */
+static float decibels(float amplitude) {
+    return 20.0f * log10f(max(amplitude, 1e-5f));
+}
+
 void App::renderGUI(RenderDevice* rd) {
 
     m_guiFont->draw3DBillboard(rd, "Click to Add/Remove Playheads", Point3(0.0, 2.45, 0), 0.1f,
@@ -193,6 +266,38 @@ void App::renderGUI(RenderDevice* rd) {
     m_guiFont->draw3DBillboard(rd, "'r' to Toggle Rainbow Mode", Point3(-2.0, -2.25, 0), 0.1f,
         m_gridColor, Color4::clear(), GFont::XALIGN_LEFT);
 
+    const MasterBus& bus = Synthesizer::global->masterBus();
+    m_guiFont->draw3DBillboard(rd, format("Peak %.1f dB  RMS %.1f dB  Limit %.1f dB", 
+        decibels(bus.peak()), decibels(bus.rms()), decibels(bus.gainReduction())), Point3(0.0, -2.25, 0), 0.1f,
+        m_gridColor, Color4::clear());
+
+}
+
+void App::drawSpectrum(RenderDevice* rd) {
+    SpectrumAnalyzer& analyzer = Synthesizer::global->analyzer();
+    analyzer.update();
+    const Array<float>& spectrum = analyzer.spectrum();
+
+    // Log-spaced bands from 40 Hz to 16 kHz, 0 dB at the top and -90 dB at the bottom
+    static const int   NUM_BANDS   = 64;
+    static const float MIN_HZ      = 40.0f;
+    static const float MAX_HZ      = 16000.0f;
+    static const float FLOOR_DB    = -90.0f;
+    static const float BOTTOM      = -2.65f;
+    static const float HEIGHT      = 0.35f;
+    const float binHz = float(Synthesizer::global->sampleRate()) / float(analyzer.frameSize());
+
+    Point3 previous;
+    for (int b = 0; b < NUM_BANDS; ++b) {
+        const float alpha = float(b) / float(NUM_BANDS - 1);
+        const int bin = clamp(iRound(MIN_HZ * powf(MAX_HZ / MIN_HZ, alpha) / binHz), 0, spectrum.size() - 1);
+        const float level = clamp(1.0f - spectrum[bin] / FLOOR_DB, 0.0f, 1.0f);
+        const Point3 p(lerp(-2.0f, 2.0f, alpha), BOTTOM + level * HEIGHT, 0.0f);
+        if (b > 0) {
+            Draw::lineSegment(LineSegment::fromTwoPoints(previous, p), rd, m_gridColor);
+        }
+        previous = p;
+    }
 }
 
 void App::onGraphics3D(RenderDevice* rd, Array<shared_ptr<Surface> >& allSurfaces) {
@@ -216,6 +321,9 @@ void App::onGraphics3D(RenderDevice* rd, Array<shared_ptr<Surface> >& allSurface
         if (m_showHelp) {
             renderGUI(rd);
         }
+        if (m_showSpectrum) {
+            drawSpectrum(rd);
+        }
         
 
     } rd->popState();
@@ -258,7 +366,8 @@ void App::onSimulation(RealTime rdt, SimTime sdt, SimTime idt) {
         m_gridColor = Color3::fromHSV(Vector3(newHue - floor(newHue), 1.0f, 1.0f));
     }
 
-    m_automata.onSimulation(Synthesizer::global->currentSampleCount(), Synthesizer::global->tick());
+    // The sequencer itself runs on its own thread, timed by the synthesizer
+    m_automata.onSimulation(sdt);
     
     // Example GUI dynamic layout code.  Resize the debugWindow to fill
     // the screen horizontally.
@@ -333,10 +442,14 @@ void App::onGraphics2D(RenderDevice* rd, Array<shared_ptr<Surface2D> >& posed2D)
 void App::onCleanup() {
     // Called after the application loop ends.  Place a majority of cleanup code
     // here instead of in the constructor so that exceptions can be caught.
-    m_rtAudio.stopStream();
-    if( m_rtAudio.isStreamOpen() )
-        m_rtAudio.closeStream();
+    if( m_rtAudio->isStreamRunning() )
+        m_rtAudio->stopStream();
+    if( m_rtAudio->isStreamOpen() )
+        m_rtAudio->closeStream();
 
+    if (!m_soundCacheFilename.empty()) {
+        SoundBank::saveCache(m_soundCacheFilename);
+    }
 }
 
 
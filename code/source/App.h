@@ -16,19 +16,25 @@
 
 #include "CellularAutomata.h"
 
-Array<float> g_currentAudioBuffer;
 /** Application framework. */
 class App : public GApp {
 protected:
-    RtAudio m_rtAudio;
-    /** Settings for RtAudio. We never need to change the defaults */
+    shared_ptr<RtAudio> m_rtAudio;
+    /** Settings for RtAudio */
     struct AudioSettings {
+      /** Interleaved output channels, spread evenly from left to right.
+          Overridden by the SUBSTEP_AUDIO_CHANNELS environment variable, and
+          limited to what the output device supports. */
       int numChannels;
       int sampleRate;
       RtAudioFormat rtAudioFormat;
+      /** If non-empty, skip the sound card and render as fast as possible
+          into this file (.wav, or raw samples otherwise) through RtAudio's
+          null device. Taken from the SUBSTEP_AUDIO_FILE environment variable. */
+      String outputFilename;
       
       AudioSettings() :
-          numChannels(1),
+          numChannels(2),
           sampleRate(48000),
           rtAudioFormat(RTAUDIO_FLOAT32) {}
     } m_audioSettings;
@@ -39,6 +45,12 @@ protected:
 
     bool m_showHelp;
     bool m_rainbowMode;
+    bool m_showSpectrum;
+
+    /** If non-empty, the rendered note cache is loaded from this file at
+        startup and written back on exit. Taken from the SUBSTEP_SOUND_CACHE
+        environment variable. */
+    String m_soundCacheFilename;
 
     /** Called from onInit */
     void makeGUI();
@@ -47,6 +59,9 @@ protected:
     
     void loadGrid();
 
+    /** Output spectrum along the bottom of the grid, from Synthesizer::analyzer() */
+    void drawSpectrum(RenderDevice* rd);
+
 public:
     
     App(const GApp::Settings& settings = GApp::Settings());
@@ -6,19 +6,59 @@ struct AudioSample {
     Array<Sample> buffer;
     /** In Hz */
     int sampleRate;
-    int sampleCount() {
+    int sampleCount() const {
         return buffer.size();
     }
+    /** 
+      dst[i] = sin(2 pi cyclesPerSample i), without calling sin() per sample.
+      Four interleaved phasors are each rotated by four samples' worth of
+      phase per step (independent lanes, so the loop vectorizes), and are
+      reseeded exactly from sin/cos every RESEED_INTERVAL samples so rounding
+      error never accumulates.
+     */
+    static void writeSine(Sample* dst, int count, double cyclesPerSample) {
+        static const int LANES = 4;
+        static const int RESEED_INTERVAL = 1024;
+        const double w = 2.0 * pi() * cyclesPerSample;
+        const double cosStep = cos(LANES * w);
+        const double sinStep = sin(LANES * w);
+        for (int start = 0; start < count; start += RESEED_INTERVAL) {
+            double re[LANES], im[LANES];
+            for (int k = 0; k < LANES; ++k) {
+                re[k] = cos(w * (start + k));
+                im[k] = sin(w * (start + k));
+            }
+            const int end = min(count, start + RESEED_INTERVAL);
+            int i = start;
+            for (; i + LANES <= end; i += LANES) {
+                for (int k = 0; k < LANES; ++k) {
+                    dst[i + k] = Sample(im[k]);
+                    const double r = re[k] * cosStep - im[k] * sinStep;
+                    im[k] = re[k] * sinStep + im[k] * cosStep;
+                    re[k] = r;
+                }
+            }
+            for (; i < end; ++i) {
+                dst[i] = Sample(sin(w * i));
+            }
+        }
+    }
+
+    /** The sine is at full scale until fadeOutProportion of the duration has
+        passed, then fades linearly to silence. A fadeOutProportion of 1 gives a
+        raw sine for use with an Envelope at playback. Mix levels are left to
+        the Synthesizer's MasterBus. */
     static shared_ptr<AudioSample> createSine(int sampleRate, double frequency, int sampleCountDuration, float fadeOutProportion) {
         shared_ptr<AudioSample> s(new AudioSample());
         s->sampleRate = sampleRate;
         s->buffer.resize(sampleCountDuration);
-        int fadeOutBeginSample = sampleCountDuration * fadeOutProportion;
-        float volume = 0.1f; // Allow ten simulataneous samples without clipping
-        for (int i = 0; i < sampleCountDuration; ++i) {
-            float sinValue = sin(2.0f * pif() * float(i) * float(frequency) / sampleRate);
-            float fade = clamp(1.0f - (float(i - fadeOutBeginSample) / (sampleCountDuration - fadeOutBeginSample)), 0.0f, 1.0f);
-            s->buffer[i] = sinValue * volume * fade;
+        Sample* dst = s->buffer.getCArray();
+        writeSine(dst, sampleCountDuration, frequency / sampleRate);
+
+        const int fadeOutBeginSample = min(int(sampleCountDuration * fadeOutProportion), sampleCountDuration);
+        const float fadeStep = 1.0f / float(max(sampleCountDuration - fadeOutBeginSample, 1));
+        for (int i = fadeOutBeginSample + 1; i < sampleCountDuration; ++i) {
+            dst[i] *= 1.0f - float(i - fadeOutBeginSample) * fadeStep;
         }
         return s;
     }
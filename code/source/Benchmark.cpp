@@ -0,0 +1,124 @@
+#include "Benchmark.h"
+#include "GridMapping.h"
+#include "PlayheadBatch.h"
+#include "AudioSample.h"
+
+const float Benchmark::INSTANCE_TOLERANCE = 1e-5f;
+const double Benchmark::SINE_TOLERANCE    = 1e-7;
+
+/** Timed runs of each case; the fastest is reported */
+static const int REPEATS = 5;
+
+/** Seconds taken by the fastest of REPEATS calls of \a f */
+template<class F>
+static RealTime fastest(const F& f) {
+    RealTime best = finf();
+    for (int r = 0; r < REPEATS; ++r) {
+        const RealTime start = System::time();
+        f();
+        best = min(best, System::time() - start);
+    }
+    return best;
+}
+
+bool Benchmark::checkPlayheadInstances() {
+    static const int   SIZE      = 1024;
+    static const float HALF_SIZE = 0.01f;
+    // Part of the way to the next cell, as between steps
+    static const float ALPHA     = 0.37f;
+
+    Array<PlayHead> heads;
+    heads.resize(1 << 20);
+    for (PlayHead& head : heads) {
+        head = PlayHead(Random::common().integer(0, SIZE - 1), Random::common().integer(0, SIZE - 1),
+                        Direction(Random::common().integer(0, Direction::DOWN_RIGHT)));
+    }
+
+    GridMapping mapping;
+    Array<Vector4> instances;
+    bool passed = true;
+    // The square, the torus and halfway between
+    for (int i = 0; i <= 2; ++i) {
+        const float interpolation = 0.5f * float(i);
+        mapping.update(SIZE, SIZE, interpolation);
+        const GridMapping::Shift shift = mapping.shift(ALPHA);
+        instances.fastClear();
+        PlayheadBatch::appendHeads(heads, mapping, shift, HALF_SIZE, instances);
+
+        float worst = 0.0f;
+        for (int h = 0; h < heads.size(); ++h) {
+            const PlayHead& head = heads[h];
+            const Vector2int16 d = vecFromDir(head.direction);
+            const Point3 expected = mapping.point(Vector2((head.position.x + ALPHA * d.x) / (SIZE - 1.0f),
+                                                          (head.position.y + ALPHA * d.y) / (SIZE - 1.0f)));
+            const Vector4& instance = instances[h];
+            worst = max(worst, (Point3(instance.x, instance.y, instance.z) - expected).length());
+            passed = passed && (instance.w == HALF_SIZE);
+        }
+        passed = passed && (instances.size() == heads.size()) && (worst <= INSTANCE_TOLERANCE);
+        printf("appendHeads, interpolation %.1f: largest error %g\n", interpolation, worst);
+    }
+
+    for (int count = 1 << 10; count <= heads.size(); count <<= 5) {
+        Array<PlayHead> some;
+        for (int h = 0; h < count; ++h) {
+            some.append(heads[h]);
+        }
+        const GridMapping::Shift shift = mapping.shift(ALPHA);
+        const RealTime t = fastest([&]() {
+            instances.fastClear();
+            PlayheadBatch::appendHeads(some, mapping, shift, HALF_SIZE, instances);
+        });
+        printf("appendHeads, %d heads: %.3f ms, %.1f ns per head\n", count, t * 1e3, t * 1e9 / count);
+    }
+
+    printf("appendHeads: %s\n", passed ? "passed" : "FAILED");
+    return passed;
+}
+
+bool Benchmark::checkSine() {
+    static const int   RATES[] = { 44100, 48000 };
+    // Ten seconds, much longer than any note played
+    static const int   DURATION = 10 * 48000;
+
+    Array<Sample> fast;
+    fast.resize(DURATION);
+    bool passed = true;
+    for (const int rate : RATES) {
+        double   worst = 0.0;
+        int      worstKey = 1;
+        RealTime fastTime = 0.0;
+        RealTime referenceTime = 0.0;
+        for (int key = 1; key <= 88; ++key) {
+            const double cyclesPerSample = pianoKeyNumberToFrequency(key) / rate;
+            fastTime += fastest([&]() {
+                AudioSample::writeSine(fast.getCArray(), DURATION, cyclesPerSample);
+            });
+
+            const double w = 2.0 * pi() * cyclesPerSample;
+            double error = 0.0;
+            const RealTime start = System::time();
+            for (int i = 0; i < DURATION; ++i) {
+                error = max(error, fabs(double(fast[i]) - sin(w * i)));
+            }
+            referenceTime += System::time() - start;
+            if (error > worst) {
+                worst    = error;
+                worstKey = key;
+            }
+        }
+        passed = passed && (worst <= SINE_TOLERANCE);
+        printf("writeSine at %d Hz: largest error %g, on key %d. %.2f ns per sample, %.2f checking against sin()\n",
+               rate, worst, worstKey, fastTime * 1e9 / (88.0 * DURATION), referenceTime * 1e9 / (88.0 * DURATION));
+    }
+
+    printf("writeSine: %s\n", passed ? "passed" : "FAILED");
+    return passed;
+}
+
+int Benchmark::run() {
+    bool passed = true;
+    passed = checkSine() && passed;
+    passed = checkPlayheadInstances() && passed;
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,40 @@
+#ifndef Benchmark_h
+#define Benchmark_h
+#include <G3D/G3DAll.h>
+
+/**
+    Headless checks and timings of the CPU-side builders, run instead of the
+    app when the SUBSTEP_BENCHMARK environment variable is set. Nothing here
+    needs a window or an audio device.
+
+    Each check compares a fast path with a direct reference, prints how far
+    apart they are and how long the fast path takes, and fails if they
+    differ by more than its tolerance.
+ */
+class Benchmark {
+public:
+    /** Largest distance between an instance and the point it should be at,
+        in world units. A cell of the board checked is about 4e-3 across */
+    static const float INSTANCE_TOLERANCE;
+
+    /** Largest difference between AudioSample::writeSine() and sin().
+        Rounding to a float Sample alone accounts for up to 3e-8 */
+    static const double SINE_TOLERANCE;
+
+private:
+    /** PlayheadBatch::appendHeads() against GridMapping::point(), which
+        places each head with its own trig instead of the tables and the
+        angle addition formulas */
+    static bool checkPlayheadInstances();
+
+    /** AudioSample::writeSine() against double precision sin(), for notes
+        long enough to span hundreds of reseeds, on every piano key at the
+        common output rates */
+    static bool checkSine();
+
+public:
+    /** Runs every check. Returns the process exit code: 0 if all passed */
+    static int run();
+};
+
+#endif
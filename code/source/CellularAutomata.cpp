@@ -1,140 +1,330 @@
 #include "CellularAutomata.h"
+#include "SoundBank.h"
 #include "util.h"
 
-static bool intersects(const Ray& mouseRay, const Vector3& center, float radius) {
-    return mouseRay.intersectionTime(Sphere(center, radius)) < 10000.0f;
+/** Length of the notes in the sample bank, in seconds. Notes are cut short by
+    the envelope, or by the end of the sample if the envelope is longer */
+static const float NOTE_DURATION = 0.3f;
+
+/** How close the square/torus morph gets to its goal before it stops */
+static const float MORPH_SNAP = 1e-3f;
+
+static float slew(float value, float goal, float delta, float alpha) {
+    return (goal - value)*alpha*delta + value;
 }
 
-static Vector2int16 vecFromDir(Direction d) {
-    switch(d) {
-    case Direction::UP:
-        return Vector2int16(0,1);
-    case Direction::DOWN:
-        return Vector2int16(0,-1);
-    case Direction::LEFT:
-        return Vector2int16(-1,0);
-    case Direction::RIGHT:
-        return Vector2int16(1,0);
-    default:
-        alwaysAssertM(false, "Invalid direction");
-        return Vector2int16(0, 0);
+/** How often the simulation thread checks the synthesizer's clock. Steps
+    land within this of their time, however slowly frames render */
+static const int SIMULATION_PERIOD_MS = 1;
+
+/** How long after its step a note plays, in seconds. Notes are queued up
+    to a poll and an audio buffer after their step, so scheduling each this
+    far from the step's own time keeps them evenly spaced */
+static const double NOTE_LOOKAHEAD = 0.02;
+
+CellularAutomata::CellularAutomata() :
+        m_sampleRate(48000),
+        m_width(0),
+        m_height(0),
+        m_paused(true),
+        m_audioWallCursor(0),
+        m_snapshotDirty(false),
+        m_quit(false),
+        m_drawWallCursor(0),
+        m_drawHeadCursor(0),
+        m_displayInterpolationFactor(0.0f),
+        m_voiceType(VoiceType::WAVETABLE),
+        m_rowTimbre(Timbre::SINE),
+        m_columnTimbre(Timbre::SINE),
+        m_noteEnvelope(defaultNoteEnvelope()),
+        m_bpm(150) {}
+
+CellularAutomata::~CellularAutomata() {
+    if (m_thread.joinable()) {
+        m_quit = true;
+        m_thread.join();
     }
 }
 
-static Direction rightOf(Direction d) {
-    switch(d) {
-    case Direction::UP:
-        return Direction::RIGHT;
-    case Direction::DOWN:
-        return Direction::LEFT;
-    case Direction::LEFT:
-        return Direction::UP;
-    case Direction::RIGHT:
-        return Direction::DOWN;
-    default:
-        alwaysAssertM(false, "Invalid direction");
-        return Direction::DOWN;
-    }
+void CellularAutomata::post(const std::function<void()>& command) {
+    std::lock_guard<std::mutex> lock(m_commandMutex);
+    m_commands.append(command);
 }
 
-static bool isVert(Direction d) {
-    return d == Direction::UP || d == Direction::DOWN;
+void CellularAutomata::runCommands() {
+    Array<std::function<void()>> commands;
+    {
+        std::lock_guard<std::mutex> lock(m_commandMutex);
+        commands.swap(m_commands);
+    }
+    for (const std::function<void()>& command : commands) {
+        command();
+    }
 }
 
-static float slew(float value, float goal, float delta, float alpha) {
-    return (goal - value)*alpha*delta + value;
+void CellularAutomata::simulationLoop() {
+    while (! m_quit) {
+        simulate();
+        std::this_thread::sleep_for(std::chrono::milliseconds(SIMULATION_PERIOD_MS));
+    }
 }
 
-void CellularAutomata::onSimulation(double currentSampleCount, double sampleDelta) {
-    SimTime deltaTime = float(sampleDelta) / m_sampleRate;
+void CellularAutomata::onSimulation(SimTime deltaTime) {
     m_displayInterpolationFactor = slew(m_displayInterpolationFactor, m_displayMode, deltaTime, 0.8f);
-    if (m_paused) {
-        m_currentTime = floor(m_currentTime / stepTime())*stepTime();
+    // The slew only approaches its goal, so finish it once the difference is
+    // invisible. Otherwise the grid mesh would be rebuilt every frame
+    if (abs(m_displayInterpolationFactor - float(m_displayMode)) < MORPH_SNAP) {
+        m_displayInterpolationFactor = float(m_displayMode);
+    }
+    postSettings();
+}
+
+void CellularAutomata::postSettings() {
+    Settings settings;
+    settings.voiceType    = m_voiceType;
+    settings.scale        = m_scale;
+    settings.rowTimbre    = m_rowTimbre;
+    settings.columnTimbre = m_columnTimbre;
+    settings.noteEnvelope = m_noteEnvelope;
+    settings.edges        = m_edges;
+    settings.lattice      = m_lattice;
+    settings.bpm          = max(m_bpm, 1);
+    // Called every frame, but the settings rarely change
+    if (settings == m_postedSettings) {
         return;
     }
-    int oldBeatNum = beatNum();
-    m_currentTime += deltaTime;
-    int newBeatNum = beatNum();
-    if (newBeatNum != oldBeatNum) {
-        step();
+    m_postedSettings = settings;
+    post([this, settings]() {
+        if (settings.bpm != m_settings.bpm) {
+            // Keep the position within the current step
+            m_currentTime *= float(m_settings.bpm) / float(settings.bpm);
+            m_snapshotDirty = true;
+        }
+        if (settings.lattice != m_settings.lattice) {
+            for (PlayHead& head : m_playhead) {
+                head.direction = (settings.lattice == Lattice::HEX) ?
+                    HexLattice::nearest(head.direction) : SquareLattice::nearest(head.direction);
+            }
+            m_snapshotDirty = true;
+        }
+        m_settings = settings;
+    });
+}
+
+void CellularAutomata::setPaused(bool b) {
+    post([this, b]() {
+        m_paused = b;
+        m_snapshotDirty = true;
+    });
+}
+
+void CellularAutomata::simulate() {
+    runCommands();
+    if (m_width == 0) {
+        // init() has not run yet
+        return;
     }
-    for (const HeadWallCollision& c : m_wallCollisions) {
-        int index = isVert(c.d) ? c.pos.x : c.pos.y;
-        Synthesizer::global->queueSound(m_soundBank[index]);
+
+    // One bank per poll, so every note of a step comes from the same bank
+    shared_ptr<const NoteBank> notes = bank();
+    if ((m_settings.scale != notes->scale) || (m_settings.rowTimbre != notes->rowTimbre) || (m_settings.columnTimbre != notes->columnTimbre) ||
+        ((m_settings.voiceType == VoiceType::SAMPLE) && (notes->samples.size() == 0))) {
+        // Switched scale, timbre or voice type since the bank was built
+        rebuildBank();
+        notes = bank();
+    }
+
+    const double currentSampleCount = Synthesizer::global->currentSampleCount();
+    SimTime deltaTime = float(Synthesizer::global->tick()) / m_sampleRate;
+    if (m_paused) {
+        m_currentTime = floor(m_currentTime / stepTime())*stepTime();
+    } else {
+        int oldBeatNum = beatNum();
+        m_currentTime += deltaTime;
+        int newBeatNum = beatNum();
+        // Every beat that began since the last poll gets its own step, so a
+        // stall, a fast tempo or rendering faster than real time never skips
+        // one. Each is timed by when it began
+        for (int beat = oldBeatNum + 1; beat <= newBeatNum; ++beat) {
+            // A step hits at most one wall per head. Room for two steps
+            // keeps the renderer, which reads once a frame, from missing
+            // any at usual frame rates
+            m_wallCollisions.reserve(2 * m_playhead.size());
+            m_headCollisions.reserve(2 * m_playhead.size());
+            const double beatSampleTime = currentSampleCount - double(m_currentTime - beat * stepTime()) * m_sampleRate;
+            step(EventTime(beat, beatSampleTime));
+            // Played before the next step, so the ring always holds them
+            playWallCollisions(*notes);
+            m_snapshotDirty = true;
+        }
+    }
+
+    // Keeps the echoes on the beat when the tempo changes
+    Synthesizer::global->delay().setTempo(float(m_settings.bpm));
+    // Free samples of finished voices here rather than on the audio thread.
+    // Returns at once unless a sample, resampler or table may be unused
+    Synthesizer::global->reclaim();
+
+    if (m_snapshotDirty) {
+        publishSnapshot();
     }
 }
 
-void CellularAutomata::step() {
-    for (auto& head : m_playhead) {
-        head.position += vecFromDir(head.direction);
+void CellularAutomata::playWallCollisions(const NoteBank& notes) {
+    m_audioWallEvents.fastClear();
+    const int missed = m_wallCollisions.read(m_audioWallCursor, m_audioWallEvents);
+    if (missed > 0) {
+        debugPrintf("Dropped %d notes: more wall hits in one step than the event ring holds\n", missed);
     }
-    for (int i = 0; i < m_playhead.size() - 1; ++i) {
-        for (int j = i+1; j < m_playhead.size(); ++j) {
-            if (m_playhead[i].position == m_playhead[j].position) {
-                Direction& d0 = m_playhead[i].direction;
-                Direction& d1 = m_playhead[j].direction;
-                d0 = rightOf(d0);
-                d1 = rightOf(d1);
-                m_headCollisions.append(HeadHeadCollision(i,j,m_playhead[i].position));
-            }
+    const double now = Synthesizer::global->currentSampleCount();
+    for (const HeadWallCollision& c : m_audioWallEvents) {
+        int index = isVert(c.d) ? c.pos.x : c.pos.y;
+        // Pan follows where the wall was hit, from the left edge to the right
+        const float position = float(c.pos.x) / float(max(m_width - 1, 1));
+        const int delay = max(0, int(c.time.sampleTime + NOTE_LOOKAHEAD * m_sampleRate - now));
+        if (m_settings.voiceType == VoiceType::SAMPLE) {
+            Synthesizer::global->queueSound(notes.samples[index], delay, m_settings.noteEnvelope, position);
+        } else {
+            const Array<Tone>& tones = isVert(c.d) ? notes.columnTones : notes.rowTones;
+            Synthesizer::global->queueTone(tones[index], m_settings.noteEnvelope, delay, position);
         }
     }
+}
 
+void CellularAutomata::publishSnapshot() {
+    shared_ptr<Snapshot> s(new Snapshot());
+    s->width          = m_width;
+    s->height         = m_height;
+    s->lattice        = m_settings.lattice;
+    s->paused         = m_paused;
+    s->playheads      = m_playhead;
+    s->beat           = beatNum();
+    s->stepAlpha      = stepAlpha();
+    s->sampleTime     = Synthesizer::global->currentSampleCount();
+    s->samplesPerStep = m_paused ? 0.0 : double(stepTime()) * double(m_sampleRate);
+    std::atomic_store(&m_snapshot, shared_ptr<const Snapshot>(s));
+    m_snapshotDirty = false;
+}
 
-    for (auto& head : m_playhead) {
-        Direction d = head.direction;
-        if ( (Direction::LEFT == d) && (head.position.x == 0) ) {
-            head.direction = Direction::RIGHT;
-            m_wallCollisions.append(HeadWallCollision(d, head.position));
-        } else if ( (Direction::RIGHT == d) && (head.position.x == m_width - 1) ) {
-            head.direction = Direction::LEFT;
-            m_wallCollisions.append(HeadWallCollision(d, head.position));
-        } else if ( (Direction::UP == d) && (head.position.y == m_height - 1) ) {
-            head.direction = Direction::DOWN;
-            m_wallCollisions.append(HeadWallCollision(d, head.position));
-        } else if ( (Direction::DOWN == d) && (head.position.y == 0) ) {
-            head.direction = Direction::UP;
-            m_wallCollisions.append(HeadWallCollision(d, head.position));
+void CellularAutomata::step(const EventTime& time) {
+    const bool wrap = (m_settings.edges == Edges::WRAP);
+    if (m_settings.lattice == Lattice::HEX) {
+        if (wrap) {
+            stepFor<WrapTopology<HexLattice>>(time);
+        } else {
+            stepFor<WallTopology<HexLattice>>(time);
+        }
+    } else {
+        if (wrap) {
+            stepFor<WrapTopology<SquareLattice>>(time);
+        } else {
+            stepFor<WallTopology<SquareLattice>>(time);
         }
     }
-  
 }
 
-Vector2 CellularAutomata::normalizedCoord(const Vector2& position) {
-    return position * Vector2(1.0f/m_width, 1.0f/m_height);
+template<class Topology>
+void CellularAutomata::stepFor(const EventTime& time) {
+    if (SmallBoard<8>::fits(m_width, m_height)) {
+        stepSmall<Topology>(m_board8, time);
+    } else if (SmallBoard<16>::fits(m_width, m_height)) {
+        stepSmall<Topology>(m_board16, time);
+    } else {
+        stepWith<Topology>(time);
+    }
 }
 
-struct PlaneProperties {
-    Vector2 dim;
-    float z;
-    PlaneProperties(float w, float h, float planeZ) : dim(w,h), z(planeZ) {}
-};
-
+template<class Topology>
+void CellularAutomata::stepWith(const EventTime& time) {
+    const int n = m_playhead.size();
+    for (auto& head : m_playhead) {
+        Topology::move(head, m_width, m_height);
+    }
 
+    // Chain the heads in each cell, so only heads that share one are
+    // compared. Linking in reverse keeps each chain in ascending order, so
+    // the pairs come out in the same order as comparing every pair would
+    m_nextHead.resize(n);
+    for (int i = n - 1; i >= 0; --i) {
+        int& first = m_cellHead[Topology::cell(m_playhead[i].position, m_width, m_height)];
+        m_nextHead[i] = first;
+        first = i;
+    }
+    for (int i = 0; i < n; ++i) {
+        for (int j = m_nextHead[i]; j >= 0; j = m_nextHead[j]) {
+            Direction& d0 = m_playhead[i].direction;
+            Direction& d1 = m_playhead[j].direction;
+            d0 = Topology::turn(d0);
+            d1 = Topology::turn(d1);
+            m_headCollisions.push(HeadHeadCollision(i, j, m_playhead[i].position, time));
+        }
+    }
+    for (const auto& head : m_playhead) {
+        m_cellHead[Topology::cell(head.position, m_width, m_height)] = -1;
+    }
 
-Vector3 CellularAutomata::normCoordToPlane(const Vector2& norm) {
-    PlaneProperties plane(float(4), float(4), 0.0f);
-    return Vector3((norm - Vector2(0.5f, 0.5f))*plane.dim, plane.z);
+    for (auto& head : m_playhead) {
+        Vector2int16 hit;
+        Direction wall;
+        if (Topology::edge(head, m_width, m_height, hit, wall)) {
+            m_wallCollisions.push(HeadWallCollision(wall, hit, time));
+        }
+    }
 }
 
-// Borrowed from http://community.wolfram.com/groups/-/m/t/176327
-Vector3 CellularAutomata::normCoordToTorus(const Vector2& norm) {
-    float r1 = 2.0f; 
-    float r2 = 1.0f;
-    float theta = norm.x * 2.0f * pif();
-    float phi   = norm.y * 2.0f * pif();
+template<class Topology, int SIZE>
+void CellularAutomata::stepSmall(SmallBoard<SIZE>& board, const EventTime& time) {
+    typedef SmallBoard<SIZE> Board;
+    board.template prepare<Topology>(m_width, m_height, m_settings.edges);
 
-    Point3 p( (r1 + r2*cos(phi))*cos(theta),
-                -r2*sin(phi),
-                (r1 + r2*cos(phi))*sin(theta));
+    const int n = m_playhead.size();
+    board.once.clear();
+    board.twice.clear();
+    for (auto& head : m_playhead) {
+        const int c = board.next[head.direction][Board::cell(head.position)];
+        head.position = Board::position(c);
+        board.occupy(board.occupancy[c]);
+    }
 
-    return p;
-}
+    // Usually no two heads share a cell, and nothing more is done
+    if (board.twice.any()) {
+        // Chains as in stepWith()
+        m_nextHead.resize(n);
+        for (int i = n - 1; i >= 0; --i) {
+            int& first = board.first[board.occupancy[Board::cell(m_playhead[i].position)]];
+            m_nextHead[i] = first;
+            first = i;
+        }
+        for (int i = 0; i < n; ++i) {
+            for (int j = m_nextHead[i]; j >= 0; j = m_nextHead[j]) {
+                Direction& d0 = m_playhead[i].direction;
+                Direction& d1 = m_playhead[j].direction;
+                d0 = Topology::turn(d0);
+                d1 = Topology::turn(d1);
+                m_headCollisions.push(HeadHeadCollision(i, j, m_playhead[i].position, time));
+            }
+        }
+        for (const auto& head : m_playhead) {
+            board.first[board.occupancy[Board::cell(head.position)]] = -1;
+        }
+    }
 
+    for (auto& head : m_playhead) {
+        if (board.edge[head.direction].test(Board::cell(head.position))) {
+            Vector2int16 hit;
+            Direction wall;
+            Topology::edge(head, m_width, m_height, hit, wall);
+            m_wallCollisions.push(HeadWallCollision(wall, hit, time));
+        }
+    }
+}
 
+Vector2 CellularAutomata::normalizedCoord(const Vector2& position) {
+    return position * Vector2(1.0f/m_width, 1.0f/m_height);
+}
 
 Vector3 CellularAutomata::normCoordTo3DPoint(const Vector2& norm) {
-    return lerp(normCoordToPlane(norm), normCoordToTorus(norm), m_displayInterpolationFactor);
+    return m_mapping.point(norm);
 }
 
 Vector3 CellularAutomata::normCoordTo3DPoint(float x, float y) {
@@ -142,55 +332,141 @@ Vector3 CellularAutomata::normCoordTo3DPoint(float x, float y) {
 }
 
 void CellularAutomata::init(int width, int height, int numPlayHeads, int bpm, int sampleRate) {
-    m_sampleRate    = sampleRate;
-    m_bpm           = bpm;
-    m_currentTime   = 0.0f;
-    m_width         = width;
-    m_height        = height;
-    m_paused        = true;
-
-    m_playhead.fastClear();
+    m_bpm = bpm;
+
+    Array<PlayHead> playheads;
+    const int directions = (m_lattice == Lattice::HEX) ? HexLattice::DIRECTIONS : SquareLattice::DIRECTIONS;
     Random& rnd = Random::common();
     for (int i = 0; i < numPlayHeads; ++i) {
     int x = rnd.integer(1, width-2);
     int y = rnd.integer(1, height-2);
-    Direction d = Direction(rnd.integer(0,3));
-        m_playhead.append(PlayHead(x,y, d));
+    Direction d = Direction(rnd.integer(0, directions - 1));
+        playheads.append(PlayHead(x,y, d));
     }
 
-    m_soundBank.fastClear();
-    Array<double> frequencies;
+    // Collisions from before a reload are never drawn
+    m_drawWallCursor = m_wallCollisions.end();
+    m_drawHeadCursor = m_headCollisions.end();
+
+    // Settings first, so the new bank is built for them
+    postSettings();
+    post([this, width, height, playheads, sampleRate]() {
+        m_sampleRate    = sampleRate;
+        m_currentTime   = 0.0f;
+        m_width         = width;
+        m_height        = height;
+        m_paused        = true;
+        m_playhead      = playheads;
+        m_cellHead.resize(width * height);
+        m_cellHead.setAll(-1);
+        // Collisions from before a reload are never played
+        m_audioWallCursor = m_wallCollisions.end();
+        rebuildBank();
+        publishSnapshot();
+    });
+
+    if (! m_thread.joinable()) {
+        m_thread = std::thread(&CellularAutomata::simulationLoop, this);
+    }
+}
+
+/** Octaves the notes of a bank climb through before folding back */
+static const int OCTAVES = 3;
+
+/** Degrees of each CellularAutomata::Scale, in ascending order from C */
+static void scaleKeys(CellularAutomata::Scale scale, Array<PianoKey>& keys) {
+    switch (scale) {
+    case CellularAutomata::Scale::PENTATONIC:
+        keys.append(PianoKey::C, PianoKey::D, PianoKey::E, PianoKey::G, PianoKey::A);
+        break;
+    case CellularAutomata::Scale::MAJOR:
+        keys.append(PianoKey::C, PianoKey::D, PianoKey::E, PianoKey::F);
+        keys.append(PianoKey::G, PianoKey::A, PianoKey::B);
+        break;
+    case CellularAutomata::Scale::MINOR:
+        keys.append(PianoKey::C, PianoKey::D, PianoKey::E_b, PianoKey::F);
+        keys.append(PianoKey::G, PianoKey::G_s, PianoKey::B_b);
+        break;
+    case CellularAutomata::Scale::BLUES:
+        keys.append(PianoKey::C, PianoKey::E_b, PianoKey::F, PianoKey::F_s);
+        keys.append(PianoKey::G, PianoKey::B_b);
+        break;
+    default:
+        alwaysAssertM(false, "Invalid scale");
+    }
+}
+
+/** A tone at \a frequency with the waveform \a timbre names */
+static Tone makeTone(CellularAutomata::Timbre timbre, double frequency) {
+    switch (timbre) {
+    case CellularAutomata::Timbre::SAW:
+        return Tone(Oscillator::Shape::SAW, frequency);
+    case CellularAutomata::Timbre::SQUARE:
+        return Tone(Oscillator::Shape::SQUARE, frequency);
+    case CellularAutomata::Timbre::TRIANGLE:
+        return Tone(Oscillator::Shape::TRIANGLE, frequency);
+    default:
+        return Tone(Wavetable::sine(), frequency);
+    }
+}
+
+shared_ptr<CellularAutomata::NoteBank> CellularAutomata::makeBank(Scale scale, bool withSamples) const {
+    shared_ptr<NoteBank> b(new NoteBank());
+    b->scale = scale;
+
     Array<PianoKey> keys;
-    keys.append(PianoKey::C, PianoKey::D, PianoKey::E, PianoKey::G, PianoKey::A);
-    for (int i = 1; i <keys.size(); ++i) {
-        frequencies.append(getFrequencyFromKey(keys[i], 3));
+    scaleKeys(scale, keys);
+    // One note per row/column, climbing the scale from its second degree in
+    // octave 3. Large boards fold back to octave 3 after octave 5, which
+    // keeps every note on the piano
+    const int noteCount = max(m_width, m_height);
+    for (int i = 1; i <= noteCount; ++i) {
+        b->frequencies.append(getFrequencyFromKey(keys[i % keys.size()], 3 + (i / keys.size()) % OCTAVES));
     }
-    for (int i = 0; i <keys.size(); ++i) {
-        frequencies.append(getFrequencyFromKey(keys[i], 4));
+
+    b->rowTimbre    = m_settings.rowTimbre;
+    b->columnTimbre = m_settings.columnTimbre;
+    for (double frequency : b->frequencies) {
+        b->rowTones.append(makeTone(m_settings.rowTimbre, frequency));
+        b->columnTones.append(makeTone(m_settings.columnTimbre, frequency));
     }
-    for (double frequency : frequencies) {
-        float duration = 0.3f;
-        float fadeOutProportion = 0.2f;
-        m_soundBank.append(AudioSample::createSine(m_sampleRate, frequency, int(duration * m_sampleRate), fadeOutProportion));
+
+    if (withSamples) {
+        for (const shared_ptr<AudioSample>& sample : SoundBank::createSines(m_sampleRate, b->frequencies, int(NOTE_DURATION * m_sampleRate), 1.0f)) {
+            b->samples.append(Synthesizer::global->addSample(sample));
+        }
     }
-  
+    return b;
+}
+
+CellularAutomata::NoteBank::~NoteBank() {
+    for (SampleHandle h : samples) {
+        Synthesizer::global->releaseSample(h);
+    }
+}
+
+void CellularAutomata::rebuildBank() {
+    // The old bank is released here, off the audio thread
+    std::atomic_store(&m_bank, shared_ptr<const NoteBank>(makeBank(m_settings.scale, m_settings.voiceType == VoiceType::SAMPLE)));
+}
+
+Envelope CellularAutomata::defaultNoteEnvelope() {
+    // Full volume for 20% of 0.3s, then a linear fade over the rest
+    return Envelope::adsr(0.0f, 0.0f, 1.0f, 0.24f, 0.06f);
 }
 
 void CellularAutomata::handleMouse(bool isPressed, bool isDown, const Ray & mouseRay, const Vector2 & mousePos) {
     m_transientPlayhead.position = Vector2int16(-5, -5);
-    if (m_paused) {
-        Point2int16 selectedPosition(-1,-1);
-        for (int x = 0; x < m_width; ++x) {
-            for (int y = 0; y < m_height; ++y) {
-                Vector2 normalizedCoord = Vector2(x,y) * 
-                    Vector2(1.0f / (m_width - 1.0f), 1.0f / (m_height - 1.0f));
-                     
-                const Point3& p = normCoordTo3DPoint(normalizedCoord);
-                if (intersects(mouseRay, p, collisionRadius())) {
-                    selectedPosition = Vector2int16(x, y);
-                }
-            }
-        }
+    const shared_ptr<const Snapshot> s = snapshot();
+    if (isNull(s)) {
+        return;
+    }
+    const int width  = s->width;
+    const int height = s->height;
+    m_mapping.update(width, height, m_displayInterpolationFactor);
+    if (s->paused) {
+        float t;
+        const Point2int16 selectedPosition = m_picker.pick(m_mapping, mouseRay, collisionRadius(*s), t);
         
         if (selectedPosition.x >= 0) {
  
@@ -202,11 +478,10 @@ void CellularAutomata::handleMouse(bool isPressed, bool isDown, const Ray & mous
             // This is the first thing due for a cleanup
             float minDistance = 10.0f; // Basically infinity...
             Vector2 normalizedCoord = Vector2(selectedPosition) *
-                Vector2(1.0f / (m_width - 1.0f), 1.0f / (m_height - 1.0f)); 
-            const Point3& center = normCoordTo3DPoint(normalizedCoord);
-            float t = mouseRay.intersectionTime(Sphere(center, collisionRadius()));
+                Vector2(1.0f / (width - 1.0f), 1.0f / (height - 1.0f)); 
             Point3 intersectionPoint = mouseRay.origin() + mouseRay.direction() * t;
-            for (int i = 0; i < 4; ++i) {
+            const int directions = (s->lattice == Lattice::HEX) ? HexLattice::DIRECTIONS : SquareLattice::DIRECTIONS;
+            for (int i = 0; i < directions; ++i) {
                 Vector2 npos = normalizedCoord + Vector2(vecFromDir(Direction(i)))*0.001f;
                 const Point3& p = normCoordTo3DPoint(npos);
                 if ((intersectionPoint - p).length() < minDistance) {
@@ -216,19 +491,24 @@ void CellularAutomata::handleMouse(bool isPressed, bool isDown, const Ray & mous
             }
 
             if (isPressed) {
-                bool removed = false;
-                for (int i = m_playhead.size() - 1; i >= 0; --i) {
-                    if (selectedPosition == m_playhead[i].position) {
-                        m_playhead.remove(i);
-                        removed = true;
-                        break;
+                // Decided against the simulation's own heads, which may have
+                // changed since the snapshot
+                const PlayHead placed = m_transientPlayhead;
+                post([this, placed]() {
+                    bool removed = false;
+                    for (int i = m_playhead.size() - 1; i >= 0; --i) {
+                        if (placed.position == m_playhead[i].position) {
+                            m_playhead.remove(i);
+                            removed = true;
+                            break;
+                        }
                     }
-                }
-                
-                if (!removed) {
-                    m_playhead.append(m_transientPlayhead);
-                }
-                
+                    
+                    if (!removed) {
+                        m_playhead.append(placed);
+                    }
+                    m_snapshotDirty = true;
+                });
             }
             
         } 
@@ -237,97 +517,91 @@ void CellularAutomata::handleMouse(bool isPressed, bool isDown, const Ray & mous
 
 }
 
-void CellularAutomata::drawSegmentedLine(RenderDevice* rd, const Color3& color, 
-        const Vector2& start, const Vector2& end, int numSegments) {
-
-    for (int i = 0; i < numSegments; ++i) {
-        Vector2 p0 = lerp(start, end, float(i) / numSegments);
-        Vector2 p1 = lerp(start, end, float(i+1) / numSegments);
-        LineSegment line = LineSegment::fromTwoPoints(normCoordTo3DPoint(p0), normCoordTo3DPoint(p1));
-        Draw::lineSegment(line, rd, color);
-    }
-
-    
+/** Farthest any point of the grid is from the origin, square or torus */
+static const float GRID_BOUNDING_RADIUS = GridMapping::MAJOR_RADIUS + GridMapping::MINOR_RADIUS;
 
+/** Screen pixels per world unit at the part of the grid nearest the camera,
+    so the detail is never too coarse anywhere */
+static float pixelsPerUnit(RenderDevice* rd) {
+    const float distance = max(rd->cameraToWorldMatrix().translation.length() - GRID_BOUNDING_RADIUS, 0.1f);
+    // The projection's y scale is cot(fieldOfView / 2), negated when rendering upside down
+    return 0.5f * rd->viewport().height() * abs(rd->projectionMatrix()[1][1]) / distance;
 }
 
 void CellularAutomata::draw(RenderDevice* rd, const Ray& mouseRay, const Color3& color) {
-
-    int numSegments = 100;
-
-    for (int i = 0; i < m_width; ++i) {
-        float alpha = float(i)/(m_width - 1.0f);
-        drawSegmentedLine(rd, color, Vector2(alpha, 0), Vector2(alpha, 1), 81);
+    const shared_ptr<const Snapshot> s = snapshot();
+    if (isNull(s)) {
+        return;
     }
+    const int width  = s->width;
+    const int height = s->height;
 
-    for (int i = 0; i < m_height; ++i) {
-        float alpha = float(i)/(m_height - 1.0f);
-        drawSegmentedLine(rd, color, Vector2(0, alpha), Vector2(1, alpha), 81);
-
+    m_mapping.update(width, height, m_displayInterpolationFactor);
+    const GridMesh::Detail detail = GridMesh::detail(m_mapping, pixelsPerUnit(rd), s->lattice == Lattice::HEX);
+    if (m_gridMesh.needsRebuild(m_mapping, detail)) {
+        m_gridMesh.build(m_mapping, detail);
     }
-    for (auto collision : m_wallCollisions) {
+
+    // Each collision is highlighted by the first frame drawn after it. A
+    // frame that falls more than the rings hold behind only loses highlights
+    m_drawWallEvents.fastClear();
+    m_drawHeadEvents.fastClear();
+    m_wallCollisions.read(m_drawWallCursor, m_drawWallEvents);
+    m_headCollisions.read(m_drawHeadCursor, m_drawHeadEvents);
+    for (auto collision : m_drawWallEvents) {
         if (isVert(collision.d)) {
-            int i = collision.pos.x;
-            float alpha = float(i) / (m_width - 1.0f);
-            drawSegmentedLine(rd, color * 1.5f, Vector2(alpha, 0), Vector2(alpha, 1), 81);
+            m_gridMesh.highlightColumn(collision.pos.x);
         } else {
-            int i = collision.pos.y;
-            float alpha = float(i) / (m_height - 1.0f);
-            drawSegmentedLine(rd, color * 1.5f, Vector2(0, alpha), Vector2(1, alpha), 81);
+            m_gridMesh.highlightRow(collision.pos.y);
         }
-    } 
-  
-    for (auto collision : m_headCollisions) {
-        const Vector2int16 pos = collision.pos;
+    }
+    m_gridMesh.draw(rd, color);
   
-
-        Vector2 normalizedCoord = Vector2(pos) * Vector2(1.0f/(m_width - 1.0f), 1.0f/(m_height - 1.0f));
-
-        Vector3 center = normCoordTo3DPoint(normalizedCoord);
-
-        Vector3 radius(0.01f, 0.01f, 0.01f);
-        Draw::box(AABox(center - radius, center + radius), rd, color*3.5f, Color4::clear());
+    const Vector2 gridScale(1.0f / (width - 1.0f), 1.0f / (height - 1.0f));
+    for (auto collision : m_drawHeadEvents) {
+        const Vector3 center = m_mapping.node(collision.pos.x, collision.pos.y);
+        m_headBatch.instances().append(Vector4(center, 0.01f));
     }
   
   
     Color4 clear = Color4::clear();
-    const float sAlpha = stepAlpha();
+    const float sAlpha = s->stepAlphaAt(Synthesizer::global->currentSampleCount());
     /*  debugPrintf("Step Alpha %f\n", sAlpha);
     debugPrintf("Time %f\n", m_currentTime);
     debugPrintf("Beat %d : %f\n", beatNum());*/
-    bool showTransientPlayhead = m_paused;
-    for (auto head : m_playhead) {
-
-        const Vector2int16 pos = head.position;
-  
-        Vector2 unnormalizedCoord = (Vector2(pos.x, pos.y) + Vector2(vecFromDir(head.direction)) * sAlpha);
-
-        Vector2 normalizedCoord = unnormalizedCoord * Vector2(1.0f/(m_width - 1.0f), 1.0f/(m_height - 1.0f));
+    const GridMapping::Shift shift = m_mapping.shift(sAlpha);
+    bool showTransientPlayhead = s->paused;
+    if (s->paused) {
+        for (auto head : s->playheads) {
+            const Vector2int16 pos = head.position;
+            Vector2 normalizedCoord = (Vector2(pos) + Vector2(vecFromDir(head.direction)) * sAlpha) * gridScale;
+            Vector3 center = m_mapping.headPoint(head, shift);
 
-        Vector3 center = normCoordTo3DPoint(normalizedCoord);
-
-        if (m_paused) { 
             float colorMultiplier = 1.0f;
             if (pos == m_transientPlayhead.position) {
                 showTransientPlayhead = false;
                 colorMultiplier = 1.5f;
             }
             Draw::arrow(center, (normCoordTo3DPoint(normalizedCoord + Vector2(vecFromDir(head.direction))) - center)*0.02f, rd, color*colorMultiplier, 0.5f);
+        }
+    } else {
+        float maxDimension = max(width - 1.0f, height - 1.0f);
+        const int splatStride = max(detail.columnStride, detail.rowStride);
+        if (splatStride > 1) {
+            // Too small to see one by one, like the lines that were dropped
+            const float cellHalfSize = 0.5f * GridMapping::PLANE_SIZE / maxDimension;
+            m_headBatch.appendSplats(s->playheads, m_mapping, splatStride, cellHalfSize, m_headBatch.instances());
         } else {
-            float maxDimension = max(m_width - 1.0f, m_height - 1.0f);
-            float r = 0.0007f*maxDimension;
-            Vector3 radius(r, r, r);
-            Draw::box(AABox(center - radius, center + radius), rd, color*3.5f, Color4::clear());
+            PlayheadBatch::appendHeads(s->playheads, m_mapping, shift, 0.0007f * maxDimension, m_headBatch.instances());
         }
     }
+    m_headBatch.draw(rd, color * 3.5f);
+
     if (showTransientPlayhead && m_transientPlayhead.position.x >= 0) {
-        Point2 normalizedCoord = Point2(m_transientPlayhead.position) * Vector2(1.0f / (m_width - 1.0f), 1.0f / (m_height - 1.0f));
+        Point2 normalizedCoord = Point2(m_transientPlayhead.position) * Vector2(1.0f / (width - 1.0f), 1.0f / (height - 1.0f));
         const Point3& center = normCoordTo3DPoint(normalizedCoord);
         Draw::arrow(center, (normCoordTo3DPoint(normalizedCoord + Vector2(vecFromDir(m_transientPlayhead.direction))) - center)*0.02f, rd, Color4(color, 0.5f), 0.5f);
     }
 
-    m_wallCollisions.fastClear();
-    m_headCollisions.fastClear();
-
 }
 
@@ -2,41 +2,147 @@
 #define CellularAutomata_h
 #include <G3D/G3DAll.h>
 #include "Synthesizer.h"
-G3D_DECLARE_ENUM_CLASS(Direction, UP, DOWN, LEFT, RIGHT);
+#include "EventRing.h"
+#include "GridMesh.h"
+#include "GridPicker.h"
+#include "PlayHead.h"
+#include "PlayheadBatch.h"
+#include "SmallBoard.h"
+#include "Topology.h"
+#include <functional>
+#include <mutex>
+#include <thread>
 
+class CellularAutomata {
+public:
+    G3D_DECLARE_ENUM_CLASS(DisplayMode, SQUARE, TORUS);
+    /** WAVETABLE renders notes on the fly from a shared table; SAMPLE plays pre-rendered buffers */
+    G3D_DECLARE_ENUM_CLASS(VoiceType, WAVETABLE, SAMPLE);
+    G3D_DECLARE_ENUM_CLASS(Scale, PENTATONIC, MAJOR, MINOR, BLUES);
+    /** Waveform of WAVETABLE voices. SINE reads the shared sine table; the
+        others are band-limited Oscillator shapes */
+    G3D_DECLARE_ENUM_CLASS(Timbre, SINE, SAW, SQUARE, TRIANGLE);
+    /** What heads do at the edges of the board. WALLS turns them back;
+        WRAP carries them around to the other side, as on the torus */
+    G3D_DECLARE_ENUM_CLASS(Edges, WALLS, WRAP);
+    /** The cells next to each cell. HEX adds the UP_LEFT and DOWN_RIGHT
+        diagonals to the square grid's four neighbors */
+    G3D_DECLARE_ENUM_CLASS(Lattice, SQUARE, HEX);
 
-struct PlayHead {
-    Vector2int16 position;
-    Direction direction;
+    /** 
+      The notes the grid plays, indexed by row/column. Never modified once
+      published, so a trigger can keep using the bank it loaded while another
+      thread swaps in a new one. Voices hold their own references to samples,
+      so notes already playing finish on the old bank.
+     */
+    struct NoteBank {
+        Scale scale;
+        Timbre rowTimbre;
+        Timbre columnTimbre;
+        Array<double> frequencies;
+        /** Played when a head hits the left or right wall, indexed by row */
+        Array<Tone> rowTones;
+        /** Played when a head hits the top or bottom wall, indexed by column */
+        Array<Tone> columnTones;
+        /** Raw sines with no fade registered with Synthesizer::global, only
+            rendered while m_voiceType is SAMPLE */
+        Array<SampleHandle> samples;
 
-    PlayHead() : position(Vector2int16(0,0)), direction(Direction::RIGHT) {}
-    PlayHead(int x, int y, Direction d = Direction::RIGHT) : position(Vector2int16(x,y)), direction(d){}
-};
+        NoteBank() {}
+        /** Releases the samples. Runs wherever the last reference to the
+            bank is dropped, which is never the audio thread */
+        ~NoteBank();
+    private:
+        /** Would release the samples twice */
+        NoteBank(const NoteBank&);
+        NoteBank& operator=(const NoteBank&);
+    };
+    /** 
+      What the sequencer looked like at one moment, published by the
+      simulation thread whenever it changes. Never modified once published, so
+      any thread can keep reading the one it loaded.
+     */
+    struct Snapshot {
+        int width;
+        int height;
+        Lattice lattice;
+        bool paused;
+        Array<PlayHead> playheads;
+        int beat;
+        /** Fraction of the current step elapsed at synthesizer sample count sampleTime */
+        float stepAlpha;
+        double sampleTime;
+        /** 0 while paused, so the heads hold still */
+        double samplesPerStep;
 
+        /** Fraction of the current step elapsed at synthesizer sample count
+            \a now, extrapolated so that heads move smoothly between snapshots */
+        float stepAlphaAt(double now) const {
+            if (samplesPerStep <= 0.0) {
+                return stepAlpha;
+            }
+            return clamp(stepAlpha + float((now - sampleTime) / samplesPerStep), 0.0f, 1.0f);
+        }
+    };
 
-class CellularAutomata {
-public:
-    G3D_DECLARE_ENUM_CLASS(DisplayMode, SQUARE, TORUS);
 protected:
 
+    /** When a collision happened: the step that caused it and the
+        synthesizer's sample count when that step was due. Its note is
+        scheduled from sampleTime */
+    struct EventTime {
+        int beat;
+        double sampleTime;
+        EventTime() : beat(0), sampleTime(0.0) {}
+        EventTime(int b, double s) : beat(b), sampleTime(s) {}
+    };
+
     struct HeadHeadCollision {
         int i0;
         int i1;
         Vector2int16 pos;
+        EventTime time;
         HeadHeadCollision() {}
-        HeadHeadCollision(int ind0, int ind1, Vector2int16 p) : 
-            i0(ind0), i1(ind1), pos(p) {}
+        HeadHeadCollision(int ind0, int ind1, Vector2int16 p, const EventTime& t) : 
+            i0(ind0), i1(ind1), pos(p), time(t) {}
     
     };
     struct HeadWallCollision {
+        /** The side of the board hit: UP, DOWN, LEFT or RIGHT */
         Direction d;
         Vector2int16 pos;
+        EventTime time;
         HeadWallCollision() {}
-        HeadWallCollision(Direction dir, Vector2int16 p) :
-            d(dir), pos(p) {}
+        HeadWallCollision(Direction dir, Vector2int16 p, const EventTime& t) :
+            d(dir), pos(p), time(t) {}
+    };
+
+    /** Everything the main thread edits that the simulation uses */
+    struct Settings {
+        VoiceType   voiceType;
+        Scale       scale;
+        Timbre      rowTimbre;
+        Timbre      columnTimbre;
+        Envelope    noteEnvelope;
+        Edges       edges;
+        Lattice     lattice;
+        int         bpm;
+        Settings() : bpm(150) {}
+
+        bool operator==(const Settings& other) const {
+            return (voiceType == other.voiceType) && (scale == other.scale) && (rowTimbre == other.rowTimbre) &&
+                (columnTimbre == other.columnTimbre) && (noteEnvelope == other.noteEnvelope) && (edges == other.edges) &&
+                (lattice == other.lattice) && (bpm == other.bpm);
+        }
     };
-    Array<HeadWallCollision> m_wallCollisions;
-    Array<HeadHeadCollision> m_headCollisions;
+
+    /** Main thread only. What postSettings() last handed over, which starts
+        out the same as m_settings */
+    Settings m_postedSettings;
+
+    // Simulation thread only. Changed from elsewhere only through post()
+
+    Settings m_settings;
 
     SimTime m_currentTime;
     
@@ -46,25 +152,108 @@ protected:
 
     bool m_paused;
 
+    Array<PlayHead> m_playhead; 
 
+    /** Per cell, the lowest-numbered head in it after the move of a step,
+        or -1. All -1 between steps */
+    Array<int> m_cellHead;
+    /** Per head, the next head in the same cell, or -1 */
+    Array<int> m_nextHead;
 
-    Array<PlayHead> m_playhead; 
-    Array<shared_ptr<AudioSample>> m_soundBank;
+    /** Used instead of m_cellHead on boards they fit */
+    SmallBoard<8>  m_board8;
+    SmallBoard<16> m_board16;
+    /** Only read and written through std::atomic_load/atomic_store */
+    shared_ptr<const NoteBank> m_bank;
+
+    EventRing<HeadWallCollision>::Cursor m_audioWallCursor;
+    /** Collisions read by the latest playWallCollisions(), reused to avoid allocating */
+    Array<HeadWallCollision> m_audioWallEvents;
+
+    /** Set when the state a Snapshot shows has changed since the last one */
+    bool m_snapshotDirty;
+
+    // Shared between the threads
+
+    /** Written by step(). The audio scheduler and the renderer each consume
+        them through their own cursor, so neither depends on how often the
+        other runs */
+    EventRing<HeadWallCollision> m_wallCollisions;
+    EventRing<HeadHeadCollision> m_headCollisions;
+
+    /** Only read and written through std::atomic_load/atomic_store */
+    shared_ptr<const Snapshot> m_snapshot;
+
+    std::mutex m_commandMutex;
+    /** Run in order on the simulation thread before its next update */
+    Array<std::function<void()>> m_commands;
+
+    std::thread m_thread;
+    std::atomic<bool> m_quit;
+
+    // Main thread only
+
+    EventRing<HeadWallCollision>::Cursor m_drawWallCursor;
+    EventRing<HeadHeadCollision>::Cursor m_drawHeadCursor;
+    /** Collisions read by the latest draw() */
+    Array<HeadWallCollision> m_drawWallEvents;
+    Array<HeadHeadCollision> m_drawHeadEvents;
+
+    float m_displayInterpolationFactor;
+
+    /** Rebuilt by draw() when the grid size or m_displayInterpolationFactor changes */
+    GridMesh m_gridMesh;
+    /** Updated to the latest snapshot's size and the current morph by
+        draw() and handleMouse() */
+    GridMapping m_mapping;
+    GridPicker  m_picker;
+    /** Moving heads and head collisions, drawn together */
+    PlayheadBatch m_headBatch;
+    
+    G3D_DECLARE_ENUM_CLASS(InputMode, DEFAULT, PLACING);
+    InputMode   m_inputMode;
+    PlayHead    m_transientPlayhead;
+
+    /** Runs on the simulation thread until m_quit is set */
+    void simulationLoop();
+
+    /** Runs the queued commands, then advances to the synthesizer's clock */
+    void simulate();
+
+    void runCommands();
+
+    /** Queues the notes of the wall collisions since the last call, each
+        NOTE_LOOKAHEAD after its step */
+    void playWallCollisions(const NoteBank& notes);
+
+    /** Publishes the current state as a new Snapshot */
+    void publishSnapshot();
+
+    /** Queues \a command to run on the simulation thread */
+    void post(const std::function<void()>& command);
+
+    /** Main thread. Copies the public settings to the simulation thread if
+        they changed since the last call */
+    void postSettings();
+
+    /** Uses m_settings. Renders the samples too if \a withSamples */
+    shared_ptr<NoteBank> makeBank(Scale scale, bool withSamples) const;
+
+    /** Builds the bank for the current settings on the simulation thread and
+        publishes it atomically. Notes triggered after it returns use it */
+    void rebuildBank();
+
+    shared_ptr<const NoteBank> bank() const {
+        return std::atomic_load(&m_bank);
+    }
   
     Vector2 normalizedCoord(const Vector2& position);
 
-    Vector3 normCoordToPlane(const Vector2& norm);
-
     Vector3 normCoordTo3DPoint(float x, float y);
     Vector3 normCoordTo3DPoint(const Vector2& norm);
-
-    void drawSegmentedLine(RenderDevice* rd, const Color3& color,
-        const Vector2& start, const Vector2& end, int numSegments);
-
-    Vector3 normCoordToTorus(const Vector2& norm);
   
     SimTime stepTime() const {
-        return (60.0f/(m_bpm)) / 2.0f;
+        return (60.0f/(m_settings.bpm)) / 2.0f;
     }
 
     int beatNum() const {
@@ -75,31 +264,81 @@ protected:
         return (m_currentTime - (beatNum() * stepTime())) / stepTime();
     }
 
-    void step();
-    float collisionRadius() const {
-        return 1.5f / float(max(m_width, m_height));
+    /** Advances the playheads and logs their collisions with \a time */
+    void step(const EventTime& time);
+
+    /** step() for \a Topology, one of the edge policies in Topology.h on
+        one of its lattices. Picks the engine for the board size */
+    template<class Topology>
+    void stepFor(const EventTime& time);
+
+    /** The engine for any board size */
+    template<class Topology>
+    void stepWith(const EventTime& time);
+
+    /** The engine for boards that fit \a board. Does what stepWith() does */
+    template<class Topology, int SIZE>
+    void stepSmall(SmallBoard<SIZE>& board, const EventTime& time);
+    static float collisionRadius(const Snapshot& s) {
+        return 1.5f / float(max(s.width, s.height));
     }
-    
-    float m_displayInterpolationFactor;
-    
-    G3D_DECLARE_ENUM_CLASS(InputMode, DEFAULT, PLACING);
-    InputMode   m_inputMode;
-    PlayHead    m_transientPlayhead;
+
 public:
     
 
-    // Public just so GUI access is easier. In a larger program I would  probably provide better encapsulation
+    // Public just so GUI access is easier. In a larger program I would  probably provide better encapsulation.
+    // These belong to the main thread; onSimulation() hands changes to the simulation thread
     DisplayMode m_displayMode;
-    int    m_bpm;
+    /** Independent of m_displayMode, so a wrapping board can be shown flat */
+    Edges       m_edges;
+    /** Heads facing directions the new lattice lacks turn to the nearest it has */
+    Lattice     m_lattice;
+    VoiceType   m_voiceType;
+    /** Changing it swaps in a new bank at the next simulation step, without
+        touching the playheads */
+    Scale       m_scale;
+    /** Like m_scale, changing these swaps in a new bank at the next step.
+        Sample voices always play sines */
+    Timbre      m_rowTimbre;
+    Timbre      m_columnTimbre;
+    /** Applied to every note as it is queued, so editing it takes effect on the next note */
+    Envelope    m_noteEnvelope;
+    int         m_bpm;
+
+    CellularAutomata();
+    /** Stops the simulation thread */
+    ~CellularAutomata();
+
+    /** Matches the fade that used to be baked into each note */
+    static Envelope defaultNoteEnvelope();
+
+    /** Main thread. Draws the latest snapshot */
     void draw(RenderDevice* rd, const Ray& mouseRay, const Color3& color);
-    void onSimulation(double currentSampleCount, double sampleDelta);
+
+    /** Main thread, once per frame. Animates the display and passes edited
+        settings on to the simulation thread */
+    void onSimulation(SimTime deltaTime);
+
+    /** Main thread. Starts the simulation thread the first time; later calls
+        replace the grid without stopping it */
     void init(int width, int height, int numPlayHeads = 0, int bpm = 150, int sampleRate = 48000);
+
+    /** Main thread. While paused, clicking a grid point adds or removes a head */
     void handleMouse(bool isPressed, bool isDown, const Ray& mouseRay, const Vector2& mousePos);
-    bool paused() const {
-        return m_paused;
+
+    /** Latest published state, or null before the simulation thread has
+        run. Safe from any thread, and never blocks */
+    shared_ptr<const Snapshot> snapshot() const {
+        return std::atomic_load(&m_snapshot);
     }
-    void setPaused(bool b) {
-        m_paused = b;
+
+    /** As of the latest snapshot */
+    bool paused() const {
+        const shared_ptr<const Snapshot> s = snapshot();
+        return isNull(s) || s->paused;
     }
+
+    /** Takes effect on the simulation thread shortly after */
+    void setPaused(bool b);
 };
 #endif
@@ -0,0 +1,338 @@
+#include "ConvolutionReverb.h"
+#include "Resampler.h"
+
+static const float DEFAULT_WET = 0.3f;
+
+static const uint16 WAVE_FORMAT_PCM        = 1;
+static const uint16 WAVE_FORMAT_IEEE_FLOAT = 3;
+static const uint16 WAVE_FORMAT_EXTENSIBLE = 0xFFFE;
+
+/** Reads 16, 24 or 32-bit PCM or 32-bit float WAV into one array per channel.
+    Returns false if the file is missing or not in one of those formats */
+static bool readWAV(const String& filename, Array<Array<float>>& channels, int& sampleRate) {
+    if (! FileSystem::exists(filename)) {
+        return false;
+    }
+    BinaryInput in(filename, G3D_LITTLE_ENDIAN);
+    if (in.getLength() < 12) {
+        return false;
+    }
+    char tag[4];
+    in.readBytes(tag, 4);
+    if (memcmp(tag, "RIFF", 4) != 0) {
+        return false;
+    }
+    in.readUInt32();
+    in.readBytes(tag, 4);
+    if (memcmp(tag, "WAVE", 4) != 0) {
+        return false;
+    }
+
+    uint16 format = 0;
+    int channelCount = 0;
+    int bits = 0;
+    sampleRate = 0;
+    while (in.getPosition() + 8 <= in.getLength()) {
+        in.readBytes(tag, 4);
+        const int64 chunkSize = in.readUInt32();
+        const int64 chunkEnd  = in.getPosition() + chunkSize;
+        if (chunkEnd > in.getLength()) {
+            return false;
+        }
+
+        if ((memcmp(tag, "fmt ", 4) == 0) && (chunkSize >= 16)) {
+            format       = in.readUInt16();
+            channelCount = in.readUInt16();
+            sampleRate   = int(in.readUInt32());
+            in.readUInt32();
+            in.readUInt16();
+            bits         = in.readUInt16();
+            if ((format == WAVE_FORMAT_EXTENSIBLE) && (chunkSize >= 40)) {
+                // cbSize, valid bits and channel mask precede the subformat
+                // GUID, whose first two bytes are the real format tag
+                in.skip(8);
+                format = in.readUInt16();
+            }
+        } else if (memcmp(tag, "data", 4) == 0) {
+            const bool pcm   = (format == WAVE_FORMAT_PCM) && ((bits == 16) || (bits == 24) || (bits == 32));
+            const bool ieee  = (format == WAVE_FORMAT_IEEE_FLOAT) && (bits == 32);
+            if ((! pcm && ! ieee) || (channelCount < 1) || (sampleRate < 1)) {
+                return false;
+            }
+            const int bytesPerSample = bits / 8;
+            const int frameCount = int(chunkSize / (bytesPerSample * channelCount));
+
+            Array<uint8> data;
+            data.resize(frameCount * bytesPerSample * channelCount);
+            in.readBytes(data.getCArray(), data.size());
+
+            channels.resize(channelCount);
+            for (int c = 0; c < channelCount; ++c) {
+                channels[c].resize(frameCount);
+            }
+            const uint8* src = data.getCArray();
+            for (int f = 0; f < frameCount; ++f) {
+                for (int c = 0; c < channelCount; ++c, src += bytesPerSample) {
+                    float value;
+                    if (ieee) {
+                        memcpy(&value, src, 4);
+                    } else if (bits == 16) {
+                        value = float(int16(src[0] | (src[1] << 8))) / 32768.0f;
+                    } else if (bits == 24) {
+                        // Sign-extend from the top byte
+                        const int32 v = int32(uint32(src[0] << 8) | uint32(src[1] << 16) | (uint32(src[2]) << 24)) >> 8;
+                        value = float(v) / 8388608.0f;
+                    } else {
+                        int32 v;
+                        memcpy(&v, src, 4);
+                        value = float(double(v) / 2147483648.0);
+                    }
+                    channels[c][f] = value;
+                }
+            }
+            return frameCount > 0;
+        }
+        // Chunks are padded to an even length
+        in.setPosition(chunkEnd + (chunkSize & 1));
+    }
+    return false;
+}
+
+shared_ptr<ConvolutionReverb> ConvolutionReverb::fromWAV(const String& filename, int sampleRate) {
+    Array<Array<float>> response;
+    int fileRate = 0;
+    if (! readWAV(filename, response, fileRate)) {
+        return nullptr;
+    }
+
+    if (fileRate != sampleRate) {
+        const shared_ptr<Resampler> resampler = Resampler::create(fileRate, sampleRate);
+        for (Array<float>& channel : response) {
+            Array<float> resampled;
+            resampled.resize(int(ceil(resampler->endPosition(channel.size()) / resampler->step())) + 1);
+            System::memset(resampled.getCArray(), 0, sizeof(float) * resampled.size());
+            double position = 0.0;
+            resampled.resize(resampler->addTo(channel.getCArray(), channel.size(), position, resampled.getCArray(), resampled.size()));
+            channel = resampled;
+        }
+    }
+
+    // Unit energy in the loudest channel keeps wet() comparable between files
+    double energy = 0.0;
+    for (const Array<float>& channel : response) {
+        double e = 0.0;
+        for (const float s : channel) {
+            e += double(s) * double(s);
+        }
+        energy = max(energy, e);
+    }
+    if (energy <= 0.0) {
+        return nullptr;
+    }
+    const float scale = float(1.0 / sqrt(energy));
+    for (Array<float>& channel : response) {
+        for (float& s : channel) {
+            s *= scale;
+        }
+    }
+
+    return create(response);
+}
+
+shared_ptr<ConvolutionReverb> ConvolutionReverb::create(const Array<Array<float>>& impulseResponse) {
+    return shared_ptr<ConvolutionReverb>(new ConvolutionReverb(impulseResponse));
+}
+
+ConvolutionReverb::ConvolutionReverb(const Array<Array<float>>& impulseResponse) :
+        m_fft(FFT_SIZE),
+        m_partitionCount(0),
+        m_wet(DEFAULT_WET),
+        m_fill(0),
+        m_delayLineHead(0) {
+    alwaysAssertM(impulseResponse.size() > 0, "Convolution reverb needs at least one impulse response");
+
+    int longest = 0;
+    for (const Array<float>& h : impulseResponse) {
+        longest = max(longest, h.size());
+    }
+    m_partitionCount = (max(longest - PARTITION_SIZE, 0) + PARTITION_SIZE - 1) / PARTITION_SIZE;
+
+    m_re.resize(FFT_SIZE);
+    m_im.resize(FFT_SIZE);
+
+    m_channels.resize(impulseResponse.size());
+    for (int c = 0; c < m_channels.size(); ++c) {
+        const Array<float>& h = impulseResponse[c];
+        Channel& channel = m_channels[c];
+
+        channel.headReversed.resize(PARTITION_SIZE);
+        for (int i = 0; i < PARTITION_SIZE; ++i) {
+            const int t = PARTITION_SIZE - 1 - i;
+            channel.headReversed[i] = (t < h.size()) ? h[t] : 0.0f;
+        }
+
+        channel.tailRe.resize(m_partitionCount * BIN_STRIDE);
+        channel.tailIm.resize(m_partitionCount * BIN_STRIDE);
+        for (int p = 0; p < m_partitionCount; ++p) {
+            // Overlap-save keeps the second half of each circular
+            // convolution, so the partition is zero-padded to FFT_SIZE
+            const int start = PARTITION_SIZE * (p + 1);
+            for (int i = 0; i < FFT_SIZE; ++i) {
+                m_re[i] = ((i < PARTITION_SIZE) && (start + i < h.size())) ? h[start + i] : 0.0f;
+                m_im[i] = 0.0f;
+            }
+            m_fft.forward(m_re.getCArray(), m_im.getCArray());
+            for (int k = 0; k < BIN_STRIDE; ++k) {
+                channel.tailRe[p * BIN_STRIDE + k] = (k < BINS) ? m_re[k] : 0.0f;
+                channel.tailIm[p * BIN_STRIDE + k] = (k < BINS) ? m_im[k] : 0.0f;
+            }
+        }
+
+        channel.tailOutput.resize(PARTITION_SIZE);
+        System::memset(channel.tailOutput.getCArray(), 0, sizeof(float) * PARTITION_SIZE);
+    }
+
+    m_input.resize(2 * PARTITION_SIZE);
+    System::memset(m_input.getCArray(), 0, sizeof(float) * m_input.size());
+
+    m_delayLineRe.resize(m_partitionCount * BIN_STRIDE);
+    m_delayLineIm.resize(m_partitionCount * BIN_STRIDE);
+    System::memset(m_delayLineRe.getCArray(), 0, sizeof(float) * m_delayLineRe.size());
+    System::memset(m_delayLineIm.getCArray(), 0, sizeof(float) * m_delayLineIm.size());
+
+    m_accumulatorRe.resize(BIN_STRIDE);
+    m_accumulatorIm.resize(BIN_STRIDE);
+    m_wetOutput.resize(PARTITION_SIZE);
+}
+
+/** sum a[i] * b[i] for i in [0, PARTITION_SIZE) */
+static inline float dotPartition(const float* a, const float* b) {
+#   ifdef SUBSTEP_SSE
+        __m128 sum0 = _mm_setzero_ps();
+        __m128 sum1 = _mm_setzero_ps();
+        for (int i = 0; i < ConvolutionReverb::PARTITION_SIZE; i += 8) {
+            sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(a + i),     _mm_loadu_ps(b + i)));
+            sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+        }
+        float lanes[4];
+        _mm_storeu_ps(lanes, _mm_add_ps(sum0, sum1));
+        return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#   else
+        float sum = 0.0f;
+        for (int i = 0; i < ConvolutionReverb::PARTITION_SIZE; ++i) {
+            sum += a[i] * b[i];
+        }
+        return sum;
+#   endif
+}
+
+void ConvolutionReverb::process(Sample* interleaved, int frameCount, int channelCount) {
+    const float wet = m_wet.load(std::memory_order_relaxed);
+    const float sendScale = 1.0f / float(channelCount);
+
+    // Work in pieces that never cross a partition boundary
+    for (int start = 0; start < frameCount; ) {
+        const int n = min(PARTITION_SIZE - m_fill, frameCount - start);
+        Sample* out = interleaved + start * channelCount;
+
+        float* send = m_input.getCArray() + PARTITION_SIZE + m_fill;
+        for (int f = 0; f < n; ++f) {
+            const Sample* frame = out + f * channelCount;
+            Sample sum = frame[0];
+            for (int c = 1; c < channelCount; ++c) {
+                sum += frame[c];
+            }
+            send[f] = sum * sendScale;
+        }
+
+        for (int r = 0; r < m_channels.size(); ++r) {
+            const Channel& channel = m_channels[r];
+            // The head runs over the PARTITION_SIZE most recent send samples,
+            // which m_input always holds contiguously
+            for (int f = 0; f < n; ++f) {
+                const int t = m_fill + f;
+                m_wetOutput[f] = wet * (dotPartition(channel.headReversed.getCArray(), m_input.getCArray() + t + 1) + channel.tailOutput[t]);
+            }
+            for (int c = r; c < channelCount; c += m_channels.size()) {
+                for (int f = 0; f < n; ++f) {
+                    out[f * channelCount + c] += m_wetOutput[f];
+                }
+            }
+        }
+
+        m_fill += n;
+        start  += n;
+        if (m_fill == PARTITION_SIZE) {
+            finishPartition();
+            m_fill = 0;
+        }
+    }
+}
+
+void ConvolutionReverb::finishPartition() {
+    float* input = m_input.getCArray();
+
+    if (m_partitionCount > 0) {
+        for (int i = 0; i < FFT_SIZE; ++i) {
+            m_re[i] = input[i];
+            m_im[i] = 0.0f;
+        }
+        m_fft.forward(m_re.getCArray(), m_im.getCArray());
+
+        m_delayLineHead = (m_delayLineHead + 1) % m_partitionCount;
+        float* newestRe = m_delayLineRe.getCArray() + m_delayLineHead * BIN_STRIDE;
+        float* newestIm = m_delayLineIm.getCArray() + m_delayLineHead * BIN_STRIDE;
+        for (int k = 0; k < BIN_STRIDE; ++k) {
+            newestRe[k] = (k < BINS) ? m_re[k] : 0.0f;
+            newestIm[k] = (k < BINS) ? m_im[k] : 0.0f;
+        }
+
+        for (Channel& channel : m_channels) {
+            float* accRe = m_accumulatorRe.getCArray();
+            float* accIm = m_accumulatorIm.getCArray();
+            System::memset(accRe, 0, sizeof(float) * BIN_STRIDE);
+            System::memset(accIm, 0, sizeof(float) * BIN_STRIDE);
+
+            // Partition p of the tail meets the input from p partitions ago
+            for (int p = 0; p < m_partitionCount; ++p) {
+                const int slot = (m_delayLineHead - p + m_partitionCount) % m_partitionCount;
+                const float* hRe = channel.tailRe.getCArray() + p * BIN_STRIDE;
+                const float* hIm = channel.tailIm.getCArray() + p * BIN_STRIDE;
+                const float* xRe = m_delayLineRe.getCArray() + slot * BIN_STRIDE;
+                const float* xIm = m_delayLineIm.getCArray() + slot * BIN_STRIDE;
+#               ifdef SUBSTEP_SSE
+                    for (int k = 0; k < BIN_STRIDE; k += 4) {
+                        const __m128 ar = _mm_loadu_ps(hRe + k);
+                        const __m128 ai = _mm_loadu_ps(hIm + k);
+                        const __m128 br = _mm_loadu_ps(xRe + k);
+                        const __m128 bi = _mm_loadu_ps(xIm + k);
+                        _mm_storeu_ps(accRe + k, _mm_add_ps(_mm_loadu_ps(accRe + k), _mm_sub_ps(_mm_mul_ps(ar, br), _mm_mul_ps(ai, bi))));
+                        _mm_storeu_ps(accIm + k, _mm_add_ps(_mm_loadu_ps(accIm + k), _mm_add_ps(_mm_mul_ps(ar, bi), _mm_mul_ps(ai, br))));
+                    }
+#               else
+                    for (int k = 0; k < BINS; ++k) {
+                        accRe[k] += hRe[k] * xRe[k] - hIm[k] * xIm[k];
+                        accIm[k] += hRe[k] * xIm[k] + hIm[k] * xRe[k];
+                    }
+#               endif
+            }
+
+            // The output is real, so the upper half of the spectrum mirrors the lower
+            for (int k = 0; k < BINS; ++k) {
+                m_re[k] = accRe[k];
+                m_im[k] = accIm[k];
+            }
+            for (int k = BINS; k < FFT_SIZE; ++k) {
+                m_re[k] =  accRe[FFT_SIZE - k];
+                m_im[k] = -accIm[FFT_SIZE - k];
+            }
+            m_fft.inverse(m_re.getCArray(), m_im.getCArray());
+
+            // The first half is circular wraparound; the second half is valid
+            System::memcpy(channel.tailOutput.getCArray(), m_re.getCArray() + PARTITION_SIZE, sizeof(float) * PARTITION_SIZE);
+        }
+    }
+
+    // The partition just finished becomes the previous one
+    System::memcpy(input, input + PARTITION_SIZE, sizeof(float) * PARTITION_SIZE);
+}
@@ -0,0 +1,104 @@
+#ifndef ConvolutionReverb_h
+#define ConvolutionReverb_h
+#include <G3D/G3DAll.h>
+#include <atomic>
+#include "util.h"
+#include "FFT.h"
+
+/**
+    Convolution reverb driven by a mono send of the mix.
+
+    The impulse response is split at PARTITION_SIZE samples. The head is
+    convolved directly in the time domain as each sample arrives, so the
+    reverb adds no latency. The rest is split into PARTITION_SIZE partitions
+    whose spectra are computed once at load, and is convolved by uniformly
+    partitioned overlap-save: each time a partition's worth of input has
+    arrived, one forward FFT feeds a frequency-domain delay line, every
+    partition's spectrum is multiplied against its delayed input spectrum,
+    and one inverse FFT yields the tail's output for the next partition. The
+    head's length hides the one-partition delay that this introduces.
+
+    Multichannel impulse responses give each output channel its own
+    response, cycling through them if there are more outputs than responses.
+
+    Nothing allocates after creation. process() must only be called from one
+    thread at a time; wet() may be changed from any thread.
+ */
+class ConvolutionReverb {
+public:
+    static const int PARTITION_SIZE = 256;
+
+private:
+    /** Overlap-save transform length */
+    static const int FFT_SIZE       = 2 * PARTITION_SIZE;
+    /** Non-redundant bins of a real signal's spectrum */
+    static const int BINS           = PARTITION_SIZE + 1;
+    /** BINS rounded up to a multiple of four for SSE */
+    static const int BIN_STRIDE     = (BINS + 3) & ~3;
+
+    struct Channel {
+        /** First PARTITION_SIZE taps of the response, reversed */
+        Array<float> headReversed;
+        /** m_partitionCount spectra of BIN_STRIDE bins each */
+        Array<float> tailRe;
+        Array<float> tailIm;
+        /** Tail output for the partition currently being played */
+        Array<float> tailOutput;
+    };
+
+    FFT                 m_fft;
+    Array<Channel>      m_channels;
+    int                 m_partitionCount;
+    std::atomic<float>  m_wet;
+
+    /** The previous and current partition of the send, contiguous */
+    Array<float>        m_input;
+    /** Samples of the current partition received so far */
+    int                 m_fill;
+
+    /** Spectra of the last m_partitionCount input blocks; m_delayLineHead is the newest */
+    Array<float>        m_delayLineRe;
+    Array<float>        m_delayLineIm;
+    int                 m_delayLineHead;
+
+    /** FFT_SIZE scratch */
+    Array<float>        m_re;
+    Array<float>        m_im;
+    /** BIN_STRIDE scratch for the multiply-accumulate */
+    Array<float>        m_accumulatorRe;
+    Array<float>        m_accumulatorIm;
+    /** Wet output of one response, shared by every channel that uses it */
+    Array<float>        m_wetOutput;
+
+    ConvolutionReverb(const Array<Array<float>>& impulseResponse);
+
+    /** Runs the partitioned convolution once m_input holds a full partition */
+    void finishPartition();
+
+public:
+    /** Returns null if \a filename is not a readable PCM or float WAV file.
+        The response is resampled to \a sampleRate if needed and normalized
+        to unit energy */
+    static shared_ptr<ConvolutionReverb> fromWAV(const String& filename, int sampleRate);
+
+    /** One response per channel, already at the output rate */
+    static shared_ptr<ConvolutionReverb> create(const Array<Array<float>>& impulseResponse);
+
+    /** Gain of the reverb added to the mix */
+    float wet() const {
+        return m_wet.load(std::memory_order_relaxed);
+    }
+
+    void setWet(float w) {
+        m_wet.store(w, std::memory_order_relaxed);
+    }
+
+    int channelCount() const {
+        return m_channels.size();
+    }
+
+    /** Adds the reverb of the mono downmix of \a interleaved to it */
+    void process(Sample* interleaved, int frameCount, int channelCount);
+};
+
+#endif
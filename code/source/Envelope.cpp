@@ -0,0 +1,115 @@
+#include "Envelope.h"
+
+/** How far an EXPONENTIAL segment bends: exp(-k) of the way remains at the end,
+    which is then snapped to the target */
+static const float EXPONENTIAL_CURVATURE = 5.0f;
+
+/** out[i] += in[i] * (gain + i * gainStep) */
+static void mixWithRamp(Sample* out, const Sample* in, int n, float gain, float gainStep) {
+    int i = 0;
+#   ifdef SUBSTEP_SSE
+        __m128 g = _mm_add_ps(_mm_set1_ps(gain), _mm_mul_ps(_mm_set1_ps(gainStep), _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f)));
+        const __m128 step4 = _mm_set1_ps(4.0f * gainStep);
+        for (; i + 4 <= n; i += 4) {
+            const __m128 v = _mm_mul_ps(_mm_loadu_ps(in + i), g);
+            _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), v));
+            g = _mm_add_ps(g, step4);
+        }
+#   endif
+    for (; i < n; ++i) {
+        out[i] += in[i] * (gain + float(i) * gainStep);
+    }
+}
+
+EnvelopeGenerator::EnvelopeGenerator(const Envelope& envelope, int sampleRate) :
+        m_exponential(envelope.curve == Envelope::Curve::EXPONENTIAL),
+        m_attackSamples(max(0, int(envelope.attackTime * sampleRate))),
+        m_decaySamples(max(0, int(envelope.decayTime * sampleRate))),
+        m_releaseSamples(max(0, int(envelope.releaseTime * sampleRate))),
+        m_sustainLevel(clamp(envelope.sustainLevel, 0.0f, 1.0f)),
+        m_gateRemaining(envelope.isFinite() ? max(0, int(envelope.gateTime * sampleRate)) : -1),
+        m_level(0.0f) {
+    beginStage(Stage::ATTACK);
+}
+
+void EnvelopeGenerator::beginStage(Stage s) {
+    m_stage          = s;
+    m_segmentStart   = m_level;
+    m_segmentElapsed = 0;
+    switch (s) {
+    case Stage::ATTACK:
+        m_segmentEnd    = 1.0f;
+        m_segmentLength = m_attackSamples;
+        break;
+    case Stage::DECAY:
+        m_segmentEnd    = m_sustainLevel;
+        m_segmentLength = m_decaySamples;
+        break;
+    case Stage::SUSTAIN:
+        m_segmentEnd    = m_sustainLevel;
+        m_segmentLength = -1;
+        break;
+    case Stage::RELEASE:
+        m_segmentEnd    = 0.0f;
+        m_segmentLength = m_releaseSamples;
+        break;
+    default:
+        m_segmentEnd    = 0.0f;
+        m_segmentLength = -1;
+        m_level         = 0.0f;
+        break;
+    }
+    if (m_segmentLength == 0) {
+        // Zero-length segments jump straight to their target
+        m_level = m_segmentEnd;
+        beginStage(Stage(s + 1));
+    }
+}
+
+float EnvelopeGenerator::segmentValue(int elapsed) const {
+    if (m_segmentLength < 0) {
+        return m_segmentEnd;
+    }
+    const float t = float(elapsed) / float(m_segmentLength);
+    float shape = t;
+    if (m_exponential) {
+        // Normalized so the segment still lands exactly on its target
+        shape = (1.0f - exp(-EXPONENTIAL_CURVATURE * t)) / (1.0f - exp(-EXPONENTIAL_CURVATURE));
+    }
+    return m_segmentStart + (m_segmentEnd - m_segmentStart) * shape;
+}
+
+int EnvelopeGenerator::mix(Sample* out, const Sample* in, int n, float volume) {
+    int done = 0;
+    while ((done < n) && (m_stage != Stage::DONE)) {
+        if (m_gateRemaining == 0) {
+            m_gateRemaining = -1;
+            beginStage(Stage::RELEASE);
+            continue;
+        }
+
+        // Run to the next block or segment boundary, or to the gate, whichever is first
+        int count = min(n - done, int(BLOCK_SIZE));
+        if (m_segmentLength >= 0) {
+            count = min(count, m_segmentLength - m_segmentElapsed);
+        }
+        if (m_gateRemaining > 0) {
+            count = min(count, m_gateRemaining);
+        }
+
+        const float endLevel = segmentValue(m_segmentElapsed + count);
+        mixWithRamp(out + done, in + done, count, m_level * volume, (endLevel - m_level) * volume / float(count));
+        m_level           = endLevel;
+        m_segmentElapsed += count;
+        done             += count;
+        if (m_gateRemaining > 0) {
+            m_gateRemaining -= count;
+        }
+
+        if ((m_segmentLength >= 0) && (m_segmentElapsed >= m_segmentLength)) {
+            m_level = m_segmentEnd;
+            beginStage(Stage(m_stage + 1));
+        }
+    }
+    return done;
+}
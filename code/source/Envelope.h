@@ -0,0 +1,114 @@
+#ifndef Envelope_h
+#define Envelope_h
+#include <G3D/G3DAll.h>
+#include "util.h"
+
+/** 
+    Attack/decay/sustain/release amplitude envelope, applied to a voice as it
+    plays so that nothing has to be re-rendered when the shape changes.
+
+    The gate closes gateTime seconds after the note starts, at which point the
+    release begins from whatever level the envelope has reached. The default
+    envelope is a pass-through: constant unit gain with the gate held open.
+ */
+class Envelope {
+public:
+    G3D_DECLARE_ENUM_CLASS(Curve, LINEAR, EXPONENTIAL);
+
+    /** In seconds */
+    float attackTime;
+    /** In seconds */
+    float decayTime;
+    /** Gain held after the decay, in [0, 1] */
+    float sustainLevel;
+    /** In seconds */
+    float releaseTime;
+    /** Seconds from note on until the release starts. finf() holds the note forever */
+    float gateTime;
+    /** Shape of the attack, decay and release segments */
+    Curve curve;
+
+    Envelope() : attackTime(0.0f), decayTime(0.0f), sustainLevel(1.0f), releaseTime(0.0f), gateTime(finf()), curve(Curve::LINEAR) {}
+
+    static Envelope adsr(float attackTime, float decayTime, float sustainLevel, float releaseTime, float gateTime, Curve curve = Curve::LINEAR) {
+        Envelope e;
+        e.attackTime   = attackTime;
+        e.decayTime    = decayTime;
+        e.sustainLevel = sustainLevel;
+        e.releaseTime  = releaseTime;
+        e.gateTime     = gateTime;
+        e.curve        = curve;
+        return e;
+    }
+
+    bool operator==(const Envelope& other) const {
+        return (attackTime == other.attackTime) && (decayTime == other.decayTime) && (sustainLevel == other.sustainLevel) &&
+            (releaseTime == other.releaseTime) && (gateTime == other.gateTime) && (curve == other.curve);
+    }
+
+    bool operator!=(const Envelope& other) const {
+        return ! (*this == other);
+    }
+
+    /** True if the envelope never changes the gain, so voices can skip it */
+    bool isPassThrough() const {
+        return (attackTime <= 0.0f) && (sustainLevel == 1.0f) && !(gateTime < finf());
+    }
+
+    /** True if the envelope eventually reaches silence on its own */
+    bool isFinite() const {
+        return gateTime < finf();
+    }
+};
+
+
+/** 
+    Per-voice envelope state. The envelope is evaluated exactly at most every
+    BLOCK_SIZE samples and at every segment boundary; the gain is ramped
+    linearly in between.
+ */
+class EnvelopeGenerator {
+public:
+    static const int BLOCK_SIZE = 64;
+
+private:
+    G3D_DECLARE_ENUM_CLASS(Stage, ATTACK, DECAY, SUSTAIN, RELEASE, DONE);
+
+    Stage   m_stage;
+    bool    m_exponential;
+    /** Stage lengths in samples */
+    int     m_attackSamples;
+    int     m_decaySamples;
+    int     m_releaseSamples;
+    float   m_sustainLevel;
+    /** Samples left until the release starts; -1 if the gate never closes */
+    int     m_gateRemaining;
+
+    /** Current segment goes from m_segmentStart to m_segmentEnd over m_segmentLength samples */
+    float   m_segmentStart;
+    float   m_segmentEnd;
+    int     m_segmentLength;
+    int     m_segmentElapsed;
+    /** Gain at the current position */
+    float   m_level;
+
+    void beginStage(Stage s);
+    float segmentValue(int elapsed) const;
+
+public:
+    EnvelopeGenerator() : m_stage(Stage::DONE), m_level(0.0f) {}
+    EnvelopeGenerator(const Envelope& envelope, int sampleRate);
+
+    bool finished() const {
+        return m_stage == Stage::DONE;
+    }
+
+    /** 
+      Adds in[i] * volume * envelope into out[i] for up to \a n samples,
+      advancing the envelope. Returns the number of samples processed, which
+      is less than \a n only if the envelope finished.
+     */
+    int mix(Sample* out, const Sample* in, int n, float volume);
+};
+
+#endif
@@ -0,0 +1,136 @@
+#ifndef EventRing_h
+#define EventRing_h
+#include <G3D/G3DAll.h>
+#include <atomic>
+
+/**
+    Log of events from one producer, read by any number of consumers that
+    each keep their own Cursor. Every consumer sees every event once, in
+    order, however often it reads, as long as it stays less than capacity()
+    events behind. One that falls further behind skips the oldest and is
+    told how many it missed.
+
+    push() never blocks or allocates. The producer makes room with
+    reserve() before a burst, which keeps the events not yet overwritten.
+    read() may run on another thread than push(); events overwritten while
+    being copied are dropped rather than returned torn. T must be copyable
+    with no side effects.
+ */
+template<class T, int CAPACITY_BITS = 10>
+class EventRing {
+public:
+    /** Capacity until reserve() grows it */
+    static const int MIN_CAPACITY = 1 << CAPACITY_BITS;
+
+    /** Sequence number of the next event a consumer will read */
+    typedef uint64 Cursor;
+
+private:
+    /** Replaced whole by reserve(), so a reader holding the old one can finish with it */
+    struct Storage {
+        /** A power of two long */
+        Array<T>    events;
+        /** Sequence number of the oldest event copied in when this was made */
+        uint64      begin;
+
+        int capacity() const {
+            return events.size();
+        }
+
+        T& operator[](uint64 c) {
+            return events[int(c & uint64(capacity() - 1))];
+        }
+
+        const T& operator[](uint64 c) const {
+            return events[int(c & uint64(capacity() - 1))];
+        }
+    };
+
+    /** Only replaced by the producer, and only read through
+        std::atomic_load by other threads */
+    shared_ptr<Storage>     m_storage;
+    /** Events pushed so far; only ever written by push() */
+    std::atomic<uint64>     m_written;
+
+public:
+    EventRing() : m_written(0) {
+        m_storage.reset(new Storage());
+        m_storage->events.resize(MIN_CAPACITY);
+        m_storage->begin = 0;
+    }
+
+    /** Producer only */
+    int capacity() const {
+        return m_storage->capacity();
+    }
+
+    /** Producer only. Grows to hold at least \a count events */
+    void reserve(int count) {
+        if (count <= capacity()) {
+            return;
+        }
+        int newCapacity = capacity();
+        while (newCapacity < count) {
+            newCapacity *= 2;
+        }
+
+        const uint64 written = m_written.load(std::memory_order_relaxed);
+        const Storage& old = *m_storage;
+        shared_ptr<Storage> s(new Storage());
+        s->events.resize(newCapacity);
+        s->begin = max(old.begin, (written > uint64(old.capacity())) ? written - old.capacity() : uint64(0));
+        for (uint64 c = s->begin; c < written; ++c) {
+            (*s)[c] = old[c];
+        }
+        std::atomic_store(&m_storage, s);
+    }
+
+    /** Producer only */
+    void push(const T& event) {
+        const uint64 w = m_written.load(std::memory_order_relaxed);
+        (*m_storage)[w] = event;
+        m_written.store(w + 1, std::memory_order_release);
+    }
+
+    /** Cursor for a consumer that only wants events pushed from now on */
+    Cursor end() const {
+        return m_written.load(std::memory_order_acquire);
+    }
+
+    /** Appends the events since \a cursor to \a out, oldest first, and
+        advances \a cursor past them. Returns how many were missed because
+        they had been overwritten */
+    int read(Cursor& cursor, Array<T>& out) const {
+        const uint64 written = m_written.load(std::memory_order_acquire);
+        // Loaded after written, so it is the storage those events went to or a newer one
+        const shared_ptr<const Storage> storage = std::atomic_load(&m_storage);
+        const uint64 capacity = uint64(storage->capacity());
+        // Storage made by a reserve() since written was loaded may start
+        // after it; the events before are then missed
+        uint64 first = min(max(cursor, storage->begin), written);
+        if (written - first > capacity) {
+            first = written - capacity;
+        }
+        const int start = out.size();
+        for (uint64 c = first; c < written; ++c) {
+            out.append((*storage)[c]);
+        }
+
+        // Events push() reached during the copy may be torn, including the
+        // one it may be overwriting right now but has not yet published
+        std::atomic_thread_fence(std::memory_order_acquire);
+        const uint64 now = m_written.load(std::memory_order_relaxed) + 1;
+        if (now - first > capacity) {
+            const uint64 valid = now - capacity;
+            const int torn = int(min(valid, written) - first);
+            out.remove(start, torn);
+            first += torn;
+        }
+
+        const int missed = int(first - cursor);
+        cursor = written;
+        return missed;
+    }
+};
+
+#endif
@@ -0,0 +1,89 @@
+#include "FFT.h"
+
+FFT::FFT(int size) : m_size(size) {
+    alwaysAssertM(isPow2(size) && (size >= 2), "FFT size must be a power of two");
+
+    int bits = 0;
+    while ((1 << bits) < size) {
+        ++bits;
+    }
+    m_bitReverse.resize(size);
+    for (int i = 0; i < size; ++i) {
+        int r = 0;
+        for (int b = 0; b < bits; ++b) {
+            r |= ((i >> b) & 1) << (bits - 1 - b);
+        }
+        m_bitReverse[i] = r;
+    }
+
+    m_twiddleRe.resize(size - 1);
+    m_twiddleIm.resize(size - 1);
+    for (int half = 1; half < size; half *= 2) {
+        for (int j = 0; j < half; ++j) {
+            const double angle = -pi() * double(j) / double(half);
+            m_twiddleRe[half - 1 + j] = float(cos(angle));
+            m_twiddleIm[half - 1 + j] = float(sin(angle));
+        }
+    }
+}
+
+void FFT::forward(float* re, float* im) const {
+    const int n = m_size;
+    for (int i = 0; i < n; ++i) {
+        const int r = m_bitReverse[i];
+        if (r > i) {
+            std::swap(re[i], re[r]);
+            std::swap(im[i], im[r]);
+        }
+    }
+
+    for (int half = 1; half < n; half *= 2) {
+        const float* wr = m_twiddleRe.getCArray() + half - 1;
+        const float* wi = m_twiddleIm.getCArray() + half - 1;
+        for (int start = 0; start < n; start += 2 * half) {
+            float* ar = re + start;
+            float* ai = im + start;
+            float* br = ar + half;
+            float* bi = ai + half;
+            int j = 0;
+#           ifdef SUBSTEP_SSE
+                for (; j + 4 <= half; j += 4) {
+                    const __m128 twr = _mm_loadu_ps(wr + j);
+                    const __m128 twi = _mm_loadu_ps(wi + j);
+                    const __m128 xr  = _mm_loadu_ps(br + j);
+                    const __m128 xi  = _mm_loadu_ps(bi + j);
+                    const __m128 tr  = _mm_sub_ps(_mm_mul_ps(twr, xr), _mm_mul_ps(twi, xi));
+                    const __m128 ti  = _mm_add_ps(_mm_mul_ps(twr, xi), _mm_mul_ps(twi, xr));
+                    const __m128 ur  = _mm_loadu_ps(ar + j);
+                    const __m128 ui  = _mm_loadu_ps(ai + j);
+                    _mm_storeu_ps(ar + j, _mm_add_ps(ur, tr));
+                    _mm_storeu_ps(ai + j, _mm_add_ps(ui, ti));
+                    _mm_storeu_ps(br + j, _mm_sub_ps(ur, tr));
+                    _mm_storeu_ps(bi + j, _mm_sub_ps(ui, ti));
+                }
+#           endif
+            for (; j < half; ++j) {
+                const float tr = wr[j] * br[j] - wi[j] * bi[j];
+                const float ti = wr[j] * bi[j] + wi[j] * br[j];
+                br[j] = ar[j] - tr;
+                bi[j] = ai[j] - ti;
+                ar[j] += tr;
+                ai[j] += ti;
+            }
+        }
+    }
+}
+
+void FFT::inverse(float* re, float* im) const {
+    // conj(forward(conj(X))) / n
+    const int n = m_size;
+    for (int i = 0; i < n; ++i) {
+        im[i] = -im[i];
+    }
+    forward(re, im);
+    const float scale = 1.0f / float(n);
+    for (int i = 0; i < n; ++i) {
+        re[i] *= scale;
+        im[i] *= -scale;
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef FFT_h
+#define FFT_h
+#include <G3D/G3DAll.h>
+#include "util.h"
+
+/**
+    In-place radix-2 complex FFT of a fixed power-of-two size, on separate
+    real and imaginary arrays so that the butterflies of every stage after
+    the second run four at a time with SSE.
+
+    The bit-reversal table and per-stage twiddles are built at construction;
+    transforms never allocate and a const FFT can be shared between threads.
+ */
+class FFT {
+private:
+    int             m_size;
+    Array<int>      m_bitReverse;
+    /** The stage whose butterflies span half = h uses h twiddles, stored at
+        index h - 1, so they can be loaded four at a time */
+    Array<float>    m_twiddleRe;
+    Array<float>    m_twiddleIm;
+
+public:
+    explicit FFT(int size);
+
+    int size() const {
+        return m_size;
+    }
+
+    /** X[k] = sum x[n] e^(-2 pi i n k / size) */
+    void forward(float* re, float* im) const;
+
+    /** x[n] = (1 / size) sum X[k] e^(2 pi i n k / size), undoing forward() */
+    void inverse(float* re, float* im) const;
+};
+
+#endif
@@ -0,0 +1,106 @@
+#include "GridMapping.h"
+
+const float GridMapping::PLANE_SIZE   = 4.0f;
+// Borrowed from http://community.wolfram.com/groups/-/m/t/176327
+const float GridMapping::MAJOR_RADIUS = 2.0f;
+const float GridMapping::MINOR_RADIUS = 1.0f;
+
+GridMapping::GridMapping() :
+    m_width(0),
+    m_height(0),
+    m_interpolation(0.0f) {}
+
+GridMapping::AxisSample GridMapping::sample(float t) {
+    const float angle = t * 2.0f * pif();
+    const AxisSample s = { (t - 0.5f) * PLANE_SIZE, cosf(angle), sinf(angle) };
+    return s;
+}
+
+void GridMapping::tabulate(int count, Array<float>& plane, Array<float>& cos, Array<float>& sin) {
+    plane.resize(count);
+    cos.resize(count);
+    sin.resize(count);
+    for (int i = 0; i < count; ++i) {
+        const AxisSample s = sample(float(i) / (count - 1.0f));
+        plane[i] = s.plane;
+        cos[i]   = s.cos;
+        sin[i]   = s.sin;
+    }
+}
+
+void GridMapping::update(int width, int height, float interpolation) {
+    const bool resized = (width != m_width) || (height != m_height);
+    if (! resized && (interpolation == m_interpolation)) {
+        return;
+    }
+    if (resized) {
+        m_width  = width;
+        m_height = height;
+        tabulate(width,  m_columnPlane, m_columnCos, m_columnSin);
+        tabulate(height, m_rowPlane,    m_rowCos,    m_rowSin);
+        m_nodeX.resize(width * height);
+        m_nodeY.resize(width * height);
+        m_nodeZ.resize(width * height);
+    }
+    m_interpolation = interpolation;
+    updateNodes();
+}
+
+void GridMapping::updateNodes() {
+    const float f = m_interpolation;
+    for (int y = 0; y < m_height; ++y) {
+        // Along a row only the column terms change
+        const float ring  = MAJOR_RADIUS + MINOR_RADIUS * m_rowCos[y];
+        const float nodeY = lerp(m_rowPlane[y], -MINOR_RADIUS * m_rowSin[y], f);
+        float* outX = m_nodeX.getCArray() + y * m_width;
+        float* outY = m_nodeY.getCArray() + y * m_width;
+        float* outZ = m_nodeZ.getCArray() + y * m_width;
+        int x = 0;
+#       ifdef SUBSTEP_SSE
+            const __m128 f4    = _mm_set1_ps(f);
+            const __m128 ring4 = _mm_set1_ps(ring);
+            const __m128 y4    = _mm_set1_ps(nodeY);
+            const __m128 fRing = _mm_set1_ps(f * ring);
+            for (; x + 4 <= m_width; x += 4) {
+                const __m128 plane = _mm_loadu_ps(m_columnPlane.getCArray() + x);
+                const __m128 torus = _mm_mul_ps(ring4, _mm_loadu_ps(m_columnCos.getCArray() + x));
+                _mm_storeu_ps(outX + x, _mm_add_ps(plane, _mm_mul_ps(f4, _mm_sub_ps(torus, plane))));
+                _mm_storeu_ps(outY + x, y4);
+                // The square has z = 0
+                _mm_storeu_ps(outZ + x, _mm_mul_ps(fRing, _mm_loadu_ps(m_columnSin.getCArray() + x)));
+            }
+#       endif
+        for (; x < m_width; ++x) {
+            outX[x] = lerp(m_columnPlane[x], ring * m_columnCos[x], f);
+            outY[x] = nodeY;
+            outZ[x] = f * ring * m_columnSin[x];
+        }
+    }
+}
+
+/** A change of \a dt in normalized coordinate, as an AxisSample */
+static GridMapping::AxisSample offset(float dt) {
+    const float angle = dt * 2.0f * pif();
+    const GridMapping::AxisSample s = { dt * GridMapping::PLANE_SIZE, cosf(angle), sinf(angle) };
+    return s;
+}
+
+GridMapping::Shift GridMapping::shift(float cells) const {
+    Shift s;
+    s.column = offset(cells / (m_width - 1.0f));
+    s.row    = offset(cells / (m_height - 1.0f));
+    return s;
+}
+
+GridMapping::AxisSample GridMapping::shifted(const AxisSample& s, const AxisSample& by, int sign) {
+    if (sign == 0) {
+        return s;
+    }
+    // cos(a + b) and sin(a + b), with b negated for sign < 0
+    const float byCos = by.cos;
+    const float bySin = float(sign) * by.sin;
+    const AxisSample r = { s.plane + float(sign) * by.plane,
+                           s.cos * byCos - s.sin * bySin,
+                           s.sin * byCos + s.cos * bySin };
+    return r;
+}
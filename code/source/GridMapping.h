@@ -0,0 +1,133 @@
+#ifndef GridMapping_h
+#define GridMapping_h
+#include <G3D/G3DAll.h>
+#include "PlayHead.h"
+#include "util.h"
+
+/**
+    Where each point of the grid is drawn: on a square, on a torus, or
+    blended between them while the display morphs.
+
+    The torus is separable, so the trig for a point only depends on its
+    column through theta and on its row through phi. update() tabulates the
+    cosine and sine of every column and row once per grid size, and the
+    position of every node once per morph factor, four nodes at a time with
+    SSE. While nothing changes, a frame costs no trig at all.
+
+    Heads between nodes are placed with the angle addition formulas from the
+    table entry of their node and a Shift computed once per frame.
+
+    Main thread only, but the const methods may be called from several
+    threads at once.
+ */
+class GridMapping {
+public:
+    /** Side of the square */
+    static const float PLANE_SIZE;
+    /** Distance from the center of the torus to the center of its tube */
+    static const float MAJOR_RADIUS;
+    /** Radius of the tube */
+    static const float MINOR_RADIUS;
+
+    /** Everything the mapping needs from one normalized coordinate t */
+    struct AxisSample {
+        /** Coordinate on the square */
+        float plane;
+        /** Of the angle 2 pi t around the torus */
+        float cos;
+        float sin;
+    };
+
+    /** A move of the same fraction of a cell along x and along y */
+    struct Shift {
+        AxisSample column;
+        AxisSample row;
+    };
+
+private:
+    int     m_width;
+    int     m_height;
+    float   m_interpolation;
+
+    // Per column (theta) and per row (phi), structure-of-arrays so the node
+    // update can load four columns at once
+    Array<float> m_columnPlane;
+    Array<float> m_columnCos;
+    Array<float> m_columnSin;
+    Array<float> m_rowPlane;
+    Array<float> m_rowCos;
+    Array<float> m_rowSin;
+
+    /** Node (x, y) is at index y * m_width + x */
+    Array<float> m_nodeX;
+    Array<float> m_nodeY;
+    Array<float> m_nodeZ;
+
+    static void tabulate(int count, Array<float>& plane, Array<float>& cos, Array<float>& sin);
+
+    void updateNodes();
+
+    /** \a s moved by \a by in the direction of \a sign */
+    static AxisSample shifted(const AxisSample& s, const AxisSample& by, int sign);
+
+public:
+    GridMapping();
+
+    /** Normalized coordinate \a t, with its trig */
+    static AxisSample sample(float t);
+
+    /** Retabulates whatever \a width, \a height and \a interpolation invalidate */
+    void update(int width, int height, float interpolation);
+
+    int width() const {
+        return m_width;
+    }
+
+    int height() const {
+        return m_height;
+    }
+
+    float interpolation() const {
+        return m_interpolation;
+    }
+
+    AxisSample column(int x) const {
+        const AxisSample s = { m_columnPlane[x], m_columnCos[x], m_columnSin[x] };
+        return s;
+    }
+
+    AxisSample row(int y) const {
+        const AxisSample s = { m_rowPlane[y], m_rowCos[y], m_rowSin[y] };
+        return s;
+    }
+
+    /** The blended point for column sample \a u and row sample \a v */
+    Point3 map(const AxisSample& u, const AxisSample& v) const {
+        const float ring = MAJOR_RADIUS + MINOR_RADIUS * v.cos;
+        const Point3 plane(u.plane, v.plane, 0.0f);
+        const Point3 torus(ring * u.cos, -MINOR_RADIUS * v.sin, ring * u.sin);
+        return lerp(plane, torus, m_interpolation);
+    }
+
+    /** Any normalized coordinate. Costs two sin/cos pairs */
+    Point3 point(const Vector2& norm) const {
+        return map(sample(norm.x), sample(norm.y));
+    }
+
+    Point3 node(int x, int y) const {
+        const int i = y * m_width + x;
+        return Point3(m_nodeX[i], m_nodeY[i], m_nodeZ[i]);
+    }
+
+    /** For moving heads \a cells of the way from one node to the next */
+    Shift shift(float cells) const;
+
+    /** Where \a head is drawn once it has moved \a s along its direction */
+    Point3 headPoint(const PlayHead& head, const Shift& s) const {
+        const Vector2int16 d = vecFromDir(head.direction);
+        return map(shifted(column(head.position.x), s.column, d.x),
+                   shifted(row(head.position.y), s.row, d.y));
+    }
+};
+
+#endif
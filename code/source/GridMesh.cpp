@@ -0,0 +1,211 @@
+#include "GridMesh.h"
+
+const float GridMesh::MAX_ERROR_PIXELS        = 0.5f;
+const float GridMesh::MIN_LINE_SPACING_PIXELS = 3.0f;
+const float GridMesh::HIGHLIGHT               = 1.5f;
+
+/** Room VertexBuffer::create() needs beyond the data for alignment */
+static const size_t BUFFER_PADDING = 16;
+
+GridMesh::GridMesh() :
+    m_width(0),
+    m_height(0),
+    m_interpolation(0.0f),
+    m_columnLines(0),
+    m_rowLines(0) {}
+
+/** Smallest power of two at least \a x, and at least 1 */
+static int powerOfTwoAbove(float x) {
+    int p = 1;
+    while ((p < (1 << 30)) && (float(p) < x)) {
+        p *= 2;
+    }
+    return p;
+}
+
+/** Pieces for a circle of \a radius pixels, bent in by the morph factor \a
+    f, to stay within MAX_ERROR_PIXELS. A circle drawn in n chords strays
+    radius * (1 - cos(pi / n)) ~ radius * pi^2 / (2 n^2) from it */
+static int segmentsFor(float radius, float f) {
+    if (f <= 0.0f) {
+        // Straight lines on the square
+        return 1;
+    }
+    const float n = pif() * sqrt(f * radius / (2.0f * GridMesh::MAX_ERROR_PIXELS));
+    // Even a tiny torus must look closed
+    return clamp(powerOfTwoAbove(n), 4, GridMesh::MAX_SEGMENTS);
+}
+
+/** Lines drawn per \a pixelsBetween pixels between neighbors, as a stride */
+static int strideFor(float pixelsBetween) {
+    return powerOfTwoAbove(GridMesh::MIN_LINE_SPACING_PIXELS / max(pixelsBetween, 1e-6f));
+}
+
+GridMesh::Detail GridMesh::detail(const GridMapping& mapping, float pixelsPerUnit, bool hex) {
+    const float f = mapping.interpolation();
+    Detail d;
+    // Column lines go around the tube, row lines around the hole, widest at
+    // the outside of the torus
+    d.columnSegments = segmentsFor(pixelsPerUnit * GridMapping::MINOR_RADIUS, f);
+    d.rowSegments    = segmentsFor(pixelsPerUnit * (GridMapping::MAJOR_RADIUS + GridMapping::MINOR_RADIUS), f);
+
+    // Spacing between neighboring lines, at the middle of the tube on the torus
+    const float columnSpacing = lerp(GridMapping::PLANE_SIZE, 2.0f * pif() * GridMapping::MAJOR_RADIUS, f) / (mapping.width() - 1.0f);
+    const float rowSpacing    = lerp(GridMapping::PLANE_SIZE, 2.0f * pif() * GridMapping::MINOR_RADIUS, f) / (mapping.height() - 1.0f);
+    d.columnStride = strideFor(pixelsPerUnit * columnSpacing);
+    d.rowStride    = strideFor(pixelsPerUnit * rowSpacing);
+    // Too dense to draw once lines are being dropped
+    d.diagonals    = hex && (d.columnStride == 1) && (d.rowStride == 1);
+    return d;
+}
+
+void GridMesh::appendLine(const GridMapping& mapping, const GridMapping::AxisSample& fixed, bool column) {
+    Point3 previous;
+    for (int i = 0; i < m_segmentSamples.size(); ++i) {
+        const GridMapping::AxisSample& along = m_segmentSamples[i];
+        const Point3 p = column ? mapping.map(fixed, along) : mapping.map(along, fixed);
+        if (i > 0) {
+            m_points.append(previous, p);
+        }
+        previous = p;
+    }
+}
+
+void GridMesh::appendDiagonals(const GridMapping& mapping, int segments) {
+    const float du = 1.0f / (mapping.width()  - 1.0f);
+    const float dv = 1.0f / (mapping.height() - 1.0f);
+    for (int y = 0; y < mapping.height() - 1; ++y) {
+        for (int x = 1; x < mapping.width(); ++x) {
+            // From node (x, y) to node (x - 1, y + 1)
+            Point3 previous = mapping.node(x, y);
+            for (int i = 1; i <= segments; ++i) {
+                const float t = float(i) / segments;
+                const Point3 p = (i == segments) ? mapping.node(x - 1, y + 1) :
+                    mapping.point(Vector2((x - t) * du, (y + t) * dv));
+                m_points.append(previous, p);
+                previous = p;
+            }
+        }
+    }
+}
+
+void GridMesh::build(const GridMapping& mapping, const Detail& detail) {
+    const int width  = mapping.width();
+    const int height = mapping.height();
+    m_width         = width;
+    m_height        = height;
+    m_interpolation = mapping.interpolation();
+    m_detail        = detail;
+
+    const int columnLines = drawnLines(width, detail.columnStride);
+    const int rowLines    = drawnLines(height, detail.rowStride);
+    const int oldPoints   = m_points.size();
+    m_points.fastClear();
+    m_segmentSamples.fastClear();
+    for (int i = 0; i <= detail.columnSegments; ++i) {
+        m_segmentSamples.append(GridMapping::sample(float(i) / detail.columnSegments));
+    }
+    for (int line = 0; line < columnLines; ++line) {
+        appendLine(mapping, mapping.column(drawnIndex(line, width, detail.columnStride)), true);
+    }
+    m_segmentSamples.fastClear();
+    for (int i = 0; i <= detail.rowSegments; ++i) {
+        m_segmentSamples.append(GridMapping::sample(float(i) / detail.rowSegments));
+    }
+    for (int line = 0; line < rowLines; ++line) {
+        appendLine(mapping, mapping.row(drawnIndex(line, height, detail.rowStride)), false);
+    }
+    if (detail.diagonals) {
+        // As finely as the lines they cross
+        const int perCell = max(detail.columnSegments / (height - 1), detail.rowSegments / (width - 1));
+        appendDiagonals(mapping, max(perCell, 1));
+    }
+
+    const bool relayout = (columnLines != m_columnLines) || (rowLines != m_rowLines) || (m_points.size() != oldPoints);
+    m_columnLines = columnLines;
+    m_rowLines    = rowLines;
+
+    const size_t positionBytes = sizeof(Point3) * m_points.size() + BUFFER_PADDING;
+    if (isNull(m_positionBuffer) || relayout) {
+        m_positionBuffer = VertexBuffer::create(positionBytes, VertexBuffer::WRITE_EVERY_FEW_FRAMES);
+    } else {
+        m_positionBuffer->reset();
+    }
+    m_positions = AttributeArray(m_points, m_positionBuffer);
+
+    if (isNull(m_brightnessBuffer) || relayout) {
+        Array<float> brightness;
+        brightness.resize(m_points.size());
+        for (float& b : brightness) {
+            b = 1.0f;
+        }
+        m_brightnessBuffer = VertexBuffer::create(sizeof(float) * brightness.size() + BUFFER_PADDING, VertexBuffer::WRITE_EVERY_FEW_FRAMES);
+        m_brightness = AttributeArray(brightness, m_brightnessBuffer);
+        // Line numbers from the old layout mean nothing now
+        m_highlighted.fastClear();
+        m_lit.fastClear();
+    }
+}
+
+int GridMesh::nearestDrawn(int index, int count, int stride) {
+    const int last = drawnLines(count, stride) - 1;
+    const int line = min((index + stride / 2) / stride, last);
+    // The last line is always drawn, so may be nearer than the regular ones
+    return (count - 1 - index < abs(drawnIndex(line, count, stride) - index)) ? last : line;
+}
+
+void GridMesh::highlightColumn(int x) {
+    if ((x >= 0) && (x < m_width)) {
+        m_highlighted.append(nearestDrawn(x, m_width, m_detail.columnStride));
+    }
+}
+
+void GridMesh::highlightRow(int y) {
+    if ((y >= 0) && (y < m_height)) {
+        m_highlighted.append(m_columnLines + nearestDrawn(y, m_height, m_detail.rowStride));
+    }
+}
+
+void GridMesh::lineVertices(int line, int& first, int& count) const {
+    if (line < m_columnLines) {
+        count = 2 * m_detail.columnSegments;
+        first = line * count;
+    } else {
+        count = 2 * m_detail.rowSegments;
+        first = m_columnLines * 2 * m_detail.columnSegments + (line - m_columnLines) * count;
+    }
+}
+
+void GridMesh::setBrightness(float* brightness, const Array<int>& lines, float value) const {
+    for (int line : lines) {
+        int first, count;
+        lineVertices(line, first, count);
+        for (int i = first; i < first + count; ++i) {
+            brightness[i] = value;
+        }
+    }
+}
+
+void GridMesh::draw(RenderDevice*, const Color3& color) {
+    if (m_points.size() == 0) {
+        return;
+    }
+
+    // Only lines whose brightness changes since the last frame are touched
+    if ((m_highlighted.size() > 0) || (m_lit.size() > 0)) {
+        float* brightness = static_cast<float*>(m_brightness.mapBuffer(GL_WRITE_ONLY));
+        setBrightness(brightness, m_lit, 1.0f);
+        setBrightness(brightness, m_highlighted, HIGHLIGHT);
+        m_brightness.unmapBuffer();
+        m_lit.fastClear();
+        m_lit.append(m_highlighted);
+        m_highlighted.fastClear();
+    }
+
+    Args args;
+    args.setPrimitiveType(PrimitiveType::LINES);
+    args.setAttributeArray("g3d_Vertex", m_positions);
+    args.setAttributeArray("brightness", m_brightness);
+    args.setUniform("color", color);
+    LAUNCH_SHADER("GridMesh.*", args);
+}
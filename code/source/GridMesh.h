@@ -0,0 +1,143 @@
+#ifndef GridMesh_h
+#define GridMesh_h
+#include <G3D/G3DAll.h>
+#include "GridMapping.h"
+
+/**
+    The row and column lines of the grid, kept on the GPU.
+
+    The vertices are only recomputed when the grid size, the square/torus
+    morph or the level of detail changes, and the whole grid draws with one
+    call, so a frame in which nothing moves costs the same however large
+    the board is.
+
+    The level of detail comes from how large the grid is on screen. Each
+    line gets just enough pieces to keep the torus curves within
+    MAX_ERROR_PIXELS of true, and when lines would be closer together than
+    MIN_LINE_SPACING_PIXELS only every second, fourth, ... one is drawn.
+    Both are rounded to powers of two so zooming seldom rebuilds.
+
+    The hex lattice's diagonals are drawn after the rows while every line
+    is, and never lit.
+
+    Each line carries a brightness attribute so that lines a head hit can be
+    lit without rebuilding anything; only the vertices of lines whose
+    brightness changed are rewritten. A hit on a line that is not drawn
+    lights the nearest one that is.
+
+    Main thread only.
+ */
+class GridMesh {
+public:
+    /** Most pieces a line is ever drawn in */
+    static const int MAX_SEGMENTS = 128;
+
+    /** Farthest a drawn curve may stray from the true one */
+    static const float MAX_ERROR_PIXELS;
+
+    /** Closest two drawn lines may be */
+    static const float MIN_LINE_SPACING_PIXELS;
+
+    /** Brightness of a lit line relative to the others */
+    static const float HIGHLIGHT;
+
+    /** How finely the grid is drawn */
+    struct Detail {
+        /** Pieces along each column line, which runs around the tube */
+        int columnSegments;
+        /** Pieces along each row line, which runs around the hole */
+        int rowSegments;
+        /** Only every columnStride-th column is drawn, and the last */
+        int columnStride;
+        int rowStride;
+        /** Draw the UP_LEFT diagonal of each cell, for the hex lattice */
+        bool diagonals;
+
+        Detail() : columnSegments(1), rowSegments(1), columnStride(1), rowStride(1), diagonals(false) {}
+
+        bool operator==(const Detail& other) const {
+            return (columnSegments == other.columnSegments) && (rowSegments == other.rowSegments) &&
+                (columnStride == other.columnStride) && (rowStride == other.rowStride) &&
+                (diagonals == other.diagonals);
+        }
+
+        bool operator!=(const Detail& other) const {
+            return ! (*this == other);
+        }
+    };
+
+private:
+    int     m_width;
+    int     m_height;
+    /** The morph the vertices were built for */
+    float   m_interpolation;
+    Detail  m_detail;
+
+    /** Lines drawn of each kind. Drawn columns come first, then rows */
+    int     m_columnLines;
+    int     m_rowLines;
+
+    shared_ptr<VertexBuffer> m_positionBuffer;
+    AttributeArray          m_positions;
+    shared_ptr<VertexBuffer> m_brightnessBuffer;
+    AttributeArray          m_brightness;
+
+    /** Scratch for build(), kept so the morph animation does not allocate */
+    Array<Point3> m_points;
+    Array<GridMapping::AxisSample> m_segmentSamples;
+
+    /** Drawn lines to light in the next draw(), and the ones lit in the last */
+    Array<int>  m_highlighted;
+    Array<int>  m_lit;
+
+    /** Lines drawn out of \a count when every \a stride-th one is, plus the last */
+    static int drawnLines(int count, int stride) {
+        return (count - 2) / stride + 2;
+    }
+
+    /** Grid column or row of drawn line \a i out of \a count */
+    static int drawnIndex(int i, int count, int stride) {
+        return min(i * stride, count - 1);
+    }
+
+    /** Drawn line nearest grid column or row \a index */
+    static int nearestDrawn(int index, int count, int stride);
+
+    /** Appends the segments of a column or row line at \a fixed, one per
+        entry of m_segmentSamples after the first */
+    void appendLine(const GridMapping& mapping, const GridMapping::AxisSample& fixed, bool column);
+
+    /** Appends the diagonal of every cell, each in \a segments pieces */
+    void appendDiagonals(const GridMapping& mapping, int segments);
+
+    /** First vertex of drawn line \a line, and how many it has */
+    void lineVertices(int line, int& first, int& count) const;
+
+    /** Writes \a value to every vertex of each of \a lines in \a brightness */
+    void setBrightness(float* brightness, const Array<int>& lines, float value) const;
+
+public:
+    GridMesh();
+
+    /** Detail for \a mapping's grid with \a pixelsPerUnit pixels per world
+        unit, with the diagonals if \a hex */
+    static Detail detail(const GridMapping& mapping, float pixelsPerUnit, bool hex);
+
+    /** True when build() must be called before draw() */
+    bool needsRebuild(const GridMapping& mapping, const Detail& detail) const {
+        return (mapping.width() != m_width) || (mapping.height() != m_height) ||
+            (mapping.interpolation() != m_interpolation) || (detail != m_detail);
+    }
+
+    /** Recomputes every vertex from \a mapping's tables */
+    void build(const GridMapping& mapping, const Detail& detail);
+
+    /** Lights column \a x or row \a y in the next draw() only */
+    void highlightColumn(int x);
+    void highlightRow(int y);
+
+    /** Draws every line in \a color, lit lines HIGHLIGHT times brighter */
+    void draw(RenderDevice* rd, const Color3& color);
+};
+
+#endif
@@ -0,0 +1,232 @@
+#include "GridPicker.h"
+
+/** Sphere tracing steps before a ray is taken to have missed the torus */
+static const int MAX_TRACE_STEPS = 256;
+/** Past this the ray has left the torus behind */
+static const float MAX_TRACE_DISTANCE = 100.0f;
+/** Fraction of the pick radius from the shell that counts as reaching it.
+    Tracing a grazing ray any closer would take many steps, and a
+    neighborhood of nodes is far wider than this */
+static const float TRACE_TOLERANCE = 0.5f;
+
+static bool intersects(const Ray& ray, const Point3& center, float radius, float& time) {
+    time = ray.intersectionTime(Sphere(center, radius));
+    return time < 10000.0f;
+}
+
+/** Signed distance from \a p to the shell within \a radius of the torus
+    surface, which holds every node sphere */
+static float shellDistance(const Point3& p, float radius) {
+    const float ring = sqrt(p.x * p.x + p.z * p.z) - GridMapping::MAJOR_RADIUS;
+    return abs(sqrt(ring * ring + p.y * p.y) - GridMapping::MINOR_RADIUS) - radius;
+}
+
+/** Fraction of a turn, in [0, 1) */
+static float turns(float angle) {
+    const float t = angle / (2.0f * pif());
+    return (t < 0.0f) ? t + 1.0f : t;
+}
+
+GridPicker::GridPicker() :
+    m_width(0),
+    m_height(0),
+    m_interpolation(0.0f),
+    m_radius(0.0f) {}
+
+void GridPicker::testNeighborhood(const GridMapping& mapping, const Ray& ray, float radius,
+        int x, int y, bool wrap, Vector2int16& best, float& bestTime) {
+
+    const int w = mapping.width();
+    const int h = mapping.height();
+    for (int dy = -1; dy <= 1; ++dy) {
+        for (int dx = -1; dx <= 1; ++dx) {
+            int nx = x + dx;
+            int ny = y + dy;
+            if (wrap) {
+                // The first and last nodes of each ring coincide
+                nx = (nx + w - 1) % (w - 1);
+                ny = (ny + h - 1) % (h - 1);
+            } else if ((nx < 0) || (nx >= w) || (ny < 0) || (ny >= h)) {
+                continue;
+            }
+            float t;
+            if (intersects(ray, mapping.node(nx, ny), radius, t) && (t < bestTime)) {
+                bestTime = t;
+                best = Vector2int16(nx, ny);
+            }
+        }
+    }
+}
+
+void GridPicker::buildHierarchy(const GridMapping& mapping, float radius) {
+    m_width         = mapping.width();
+    m_height        = mapping.height();
+    m_interpolation = mapping.interpolation();
+    m_radius        = radius;
+    m_levels.fastClear();
+
+    const Vector3 pad(radius, radius, radius);
+    Level leaves;
+    leaves.span   = LEAF_SIZE;
+    leaves.width  = (m_width  + LEAF_SIZE - 1) / LEAF_SIZE;
+    leaves.height = (m_height + LEAF_SIZE - 1) / LEAF_SIZE;
+    for (int by = 0; by < leaves.height; ++by) {
+        for (int bx = 0; bx < leaves.width; ++bx) {
+            Point3 low  = mapping.node(bx * LEAF_SIZE, by * LEAF_SIZE);
+            Point3 high = low;
+            for (int y = by * LEAF_SIZE; y < min((by + 1) * LEAF_SIZE, m_height); ++y) {
+                for (int x = bx * LEAF_SIZE; x < min((bx + 1) * LEAF_SIZE, m_width); ++x) {
+                    const Point3 p = mapping.node(x, y);
+                    low  = low.min(p);
+                    high = high.max(p);
+                }
+            }
+            leaves.boxes.append(AABox(low - pad, high + pad));
+        }
+    }
+    m_levels.append(leaves);
+
+    // Each parent bounds up to 2x2 children
+    while ((m_levels.last().width > 1) || (m_levels.last().height > 1)) {
+        const Level& child = m_levels.last();
+        Level parent;
+        parent.span   = child.span * 2;
+        parent.width  = (child.width  + 1) / 2;
+        parent.height = (child.height + 1) / 2;
+        for (int by = 0; by < parent.height; ++by) {
+            for (int bx = 0; bx < parent.width; ++bx) {
+                AABox box = child.boxes[(2 * by) * child.width + 2 * bx];
+                for (int cy = 2 * by; cy < min(2 * by + 2, child.height); ++cy) {
+                    for (int cx = 2 * bx; cx < min(2 * bx + 2, child.width); ++cx) {
+                        box.merge(child.boxes[cy * child.width + cx]);
+                    }
+                }
+                parent.boxes.append(box);
+            }
+        }
+        m_levels.append(parent);
+    }
+}
+
+void GridPicker::pickHierarchy(const GridMapping& mapping, const Ray& ray, float radius,
+        Vector2int16& best, float& bestTime) {
+
+    if ((mapping.width() != m_width) || (mapping.height() != m_height) ||
+        (mapping.interpolation() != m_interpolation) || (radius != m_radius)) {
+        buildHierarchy(mapping, radius);
+    }
+
+    Array<Vector3int32>& stack = m_stack;
+    stack.fastClear();
+    stack.append(Vector3int32(m_levels.size() - 1, 0, 0));
+    while (stack.size() > 0) {
+        const Vector3int32 entry = stack.pop();
+        const Level& level = m_levels[entry.x];
+        // Boxes behind the best hit so far cannot hold a nearer one
+        if (ray.intersectionTime(level.boxes[entry.z * level.width + entry.y]) >= bestTime) {
+            continue;
+        }
+        if (entry.x == 0) {
+            for (int y = entry.z * LEAF_SIZE; y < min((entry.z + 1) * LEAF_SIZE, m_height); ++y) {
+                for (int x = entry.y * LEAF_SIZE; x < min((entry.y + 1) * LEAF_SIZE, m_width); ++x) {
+                    float t;
+                    if (intersects(ray, mapping.node(x, y), radius, t) && (t < bestTime)) {
+                        bestTime = t;
+                        best = Vector2int16(x, y);
+                    }
+                }
+            }
+        } else {
+            const Level& child = m_levels[entry.x - 1];
+            for (int cy = 2 * entry.z; cy < min(2 * entry.z + 2, child.height); ++cy) {
+                for (int cx = 2 * entry.y; cx < min(2 * entry.y + 2, child.width); ++cx) {
+                    stack.append(Vector3int32(entry.x - 1, cx, cy));
+                }
+            }
+        }
+    }
+}
+
+Vector2int16 GridPicker::pick(const GridMapping& mapping, const Ray& ray, float radius, float& time) {
+    Vector2int16 best(-1, -1);
+    time = finf();
+    const int w = mapping.width();
+    const int h = mapping.height();
+    if ((w < 2) || (h < 2)) {
+        return best;
+    }
+
+    if (mapping.interpolation() == 0.0f) {
+        // The node spheres fill the slab |z| <= radius over the square. Walk
+        // the nodes under the part of the ray inside it, which is usually a
+        // single cell and only grows for rays that graze the square
+        const float half = GridMapping::PLANE_SIZE * 0.5f + radius;
+        const Point3 low(-half, -half, -radius);
+        const Point3 high(half, half, radius);
+        float enter = 0.0f;
+        float exit  = finf();
+        for (int axis = 0; axis < 3; ++axis) {
+            const float o = ray.origin()[axis];
+            const float d = ray.direction()[axis];
+            if (abs(d) < 1e-9f) {
+                if ((o < low[axis]) || (o > high[axis])) {
+                    return best;
+                }
+                continue;
+            }
+            float t0 = (low[axis]  - o) / d;
+            float t1 = (high[axis] - o) / d;
+            if (t0 > t1) {
+                std::swap(t0, t1);
+            }
+            enter = max(enter, t0);
+            exit  = min(exit, t1);
+        }
+        if (enter > exit) {
+            return best;
+        }
+
+        const Vector2 cellsPerUnit((w - 1) / GridMapping::PLANE_SIZE, (h - 1) / GridMapping::PLANE_SIZE);
+        const Point3  a = ray.origin() + ray.direction() * enter;
+        const Point3  b = ray.origin() + ray.direction() * exit;
+        const Vector2 start = (a.xy() + Vector2(half - radius, half - radius)) * cellsPerUnit;
+        const Vector2 end   = (b.xy() + Vector2(half - radius, half - radius)) * cellsPerUnit;
+        // Half-cell steps, each testing its neighborhood, cannot skip a node.
+        // A neighborhood reaches a cell ahead, so after the first hit the
+        // next two steps may still find a nearer one
+        const int steps = 1 + iCeil(2.0f * max(abs(end.x - start.x), abs(end.y - start.y)));
+        int stepsAfterHit = 0;
+        for (int i = 0; (i <= steps) && (stepsAfterHit <= 2); ++i) {
+            const Vector2 c = lerp(start, end, float(i) / steps);
+            testNeighborhood(mapping, ray, radius, clamp(iRound(c.x), 0, w - 1), clamp(iRound(c.y), 0, h - 1), false, best, time);
+            if (best.x >= 0) {
+                ++stepsAfterHit;
+            }
+        }
+    } else if (mapping.interpolation() == 1.0f) {
+        // Trace to the shell, test the nodes next to where the ray is in
+        // it, and step through it until one is hit. The ray may cross the
+        // surface up to four times
+        float t = 0.0f;
+        for (int i = 0; (i < MAX_TRACE_STEPS) && (t < MAX_TRACE_DISTANCE); ++i) {
+            const Point3 p = ray.origin() + ray.direction() * t;
+            const float distance = shellDistance(p, radius);
+            if (distance > TRACE_TOLERANCE * radius) {
+                t += distance;
+                continue;
+            }
+            // Inverse of GridMapping::map, with theta around y and y = -r sin(phi)
+            const float ring = sqrt(p.x * p.x + p.z * p.z) - GridMapping::MAJOR_RADIUS;
+            const int x = iRound(turns(atan2(p.z, p.x)) * (w - 1));
+            const int y = iRound(turns(atan2(-p.y, ring)) * (h - 1));
+            testNeighborhood(mapping, ray, radius, x, y, true, best, time);
+            if (best.x >= 0) {
+                break;
+            }
+            t += radius;
+        }
+    } else {
+        pickHierarchy(mapping, ray, radius, best, time);
+    }
+    return best;
+}
@@ -0,0 +1,65 @@
+#ifndef GridPicker_h
+#define GridPicker_h
+#include <G3D/G3DAll.h>
+#include "GridMapping.h"
+
+/**
+    Finds the grid node under the mouse without testing every node.
+
+    On the square the ray is intersected with its plane, and on the torus
+    the torus is sphere-traced and the hit inverted to (theta, phi). Either
+    way only the nearest node and its neighbors are tested, so the cost
+    does not depend on the grid size.
+
+    While the display morphs between the two, the nodes are kept in a
+    hierarchy of bounding boxes over blocks of the grid, rebuilt when the
+    mapping changes, and the ray only descends into boxes it enters.
+
+    Main thread only.
+ */
+class GridPicker {
+public:
+    /** Nodes per side of the blocks at the bottom of the hierarchy */
+    static const int LEAF_SIZE = 4;
+
+private:
+    /** One level of the hierarchy. Box (x, y) bounds the nodes
+        [x, x + span) x [y, y + span), padded by the pick radius */
+    struct Level {
+        int width;
+        int height;
+        int span;
+        Array<AABox> boxes;
+    };
+
+    /** Finest first; the last has a single box */
+    Array<Level> m_levels;
+
+    /** (level, x, y) of the boxes pickHierarchy() has still to visit */
+    Array<Vector3int32> m_stack;
+
+    /** What m_levels was built for */
+    int     m_width;
+    int     m_height;
+    float   m_interpolation;
+    float   m_radius;
+
+    void buildHierarchy(const GridMapping& mapping, float radius);
+
+    /** Tests the nodes within one of (\a x, \a y), wrapping around the
+        seam if \a wrap. Keeps the first hit in \a best and \a bestTime */
+    static void testNeighborhood(const GridMapping& mapping, const Ray& ray, float radius,
+        int x, int y, bool wrap, Vector2int16& best, float& bestTime);
+
+    void pickHierarchy(const GridMapping& mapping, const Ray& ray, float radius,
+        Vector2int16& best, float& bestTime);
+
+public:
+    GridPicker();
+
+    /** The node whose sphere of \a radius \a ray enters first, or (-1, -1).
+        Sets \a time to where the ray enters it */
+    Vector2int16 pick(const GridMapping& mapping, const Ray& ray, float radius, float& time);
+};
+
+#endif
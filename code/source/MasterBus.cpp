@@ -0,0 +1,221 @@
+#include "MasterBus.h"
+
+/** -1 dBFS, leaving room for inter-sample peaks in the DAC */
+static const float CEILING = 0.891f;
+
+static const float DEFAULT_GAIN         = 0.25f;
+static const float DEFAULT_RELEASE_TIME = 0.1f;
+
+/** Pade approximant of tanh, exact at +/-3 where it reaches +/-1 */
+static inline float softClipSample(float x) {
+    x = clamp(x, -3.0f, 3.0f);
+    const float x2 = x * x;
+    return x * (27.0f + x2) / (27.0f + 9.0f * x2);
+}
+
+/** dst[i] = src[i] * gain, soft clipped if \a clip */
+static void applyGain(Sample* dst, const Sample* src, int n, float gain, bool clip) {
+    int i = 0;
+#   ifdef SUBSTEP_SSE
+        const __m128 g = _mm_set1_ps(gain);
+        if (clip) {
+            const __m128 lo = _mm_set1_ps(-3.0f);
+            const __m128 hi = _mm_set1_ps(3.0f);
+            const __m128 c27 = _mm_set1_ps(27.0f);
+            const __m128 c9 = _mm_set1_ps(9.0f);
+            for (; i + 4 <= n; i += 4) {
+                const __m128 x  = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(src + i), g), lo), hi);
+                const __m128 x2 = _mm_mul_ps(x, x);
+                _mm_storeu_ps(dst + i, _mm_div_ps(_mm_mul_ps(x, _mm_add_ps(c27, x2)), _mm_add_ps(c27, _mm_mul_ps(c9, x2))));
+            }
+        } else {
+            for (; i + 4 <= n; i += 4) {
+                _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_loadu_ps(src + i), g));
+            }
+        }
+#   endif
+    for (; i < n; ++i) {
+        dst[i] = clip ? softClipSample(src[i] * gain) : src[i] * gain;
+    }
+}
+
+/** out[i] = in[i] * (gain + i * gainStep). Returns the largest absolute
+    output and adds the sum of squared outputs to \a sumSquares */
+static float applyRamp(Sample* out, const Sample* in, int n, float gain, float gainStep, float& sumSquares) {
+    int i = 0;
+    float peak = 0.0f;
+#   ifdef SUBSTEP_SSE
+        __m128 g = _mm_add_ps(_mm_set1_ps(gain), _mm_mul_ps(_mm_set1_ps(gainStep), _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f)));
+        const __m128 step4 = _mm_set1_ps(4.0f * gainStep);
+        const __m128 signBit = _mm_set1_ps(-0.0f);
+        __m128 peak4 = _mm_setzero_ps();
+        __m128 sum4 = _mm_setzero_ps();
+        for (; i + 4 <= n; i += 4) {
+            const __m128 v = _mm_mul_ps(_mm_loadu_ps(in + i), g);
+            _mm_storeu_ps(out + i, v);
+            peak4 = _mm_max_ps(peak4, _mm_andnot_ps(signBit, v));
+            sum4  = _mm_add_ps(sum4, _mm_mul_ps(v, v));
+            g = _mm_add_ps(g, step4);
+        }
+        float lanes[4];
+        _mm_storeu_ps(lanes, peak4);
+        peak = max(max(lanes[0], lanes[1]), max(lanes[2], lanes[3]));
+        _mm_storeu_ps(lanes, sum4);
+        sumSquares += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#   endif
+    for (; i < n; ++i) {
+        out[i] = in[i] * (gain + float(i) * gainStep);
+        peak = max(peak, fabsf(out[i]));
+        sumSquares += out[i] * out[i];
+    }
+    return peak;
+}
+
+/** out[i] = in[i] * gains[i]. Returns the largest absolute output and adds
+    the sum of squared outputs to \a sumSquares */
+static float applyGains(Sample* out, const Sample* in, int n, const Sample* gains, float& sumSquares) {
+    int i = 0;
+    float peak = 0.0f;
+#   ifdef SUBSTEP_SSE
+        const __m128 signBit = _mm_set1_ps(-0.0f);
+        __m128 peak4 = _mm_setzero_ps();
+        __m128 sum4 = _mm_setzero_ps();
+        for (; i + 4 <= n; i += 4) {
+            const __m128 v = _mm_mul_ps(_mm_loadu_ps(in + i), _mm_loadu_ps(gains + i));
+            _mm_storeu_ps(out + i, v);
+            peak4 = _mm_max_ps(peak4, _mm_andnot_ps(signBit, v));
+            sum4  = _mm_add_ps(sum4, _mm_mul_ps(v, v));
+        }
+        float lanes[4];
+        _mm_storeu_ps(lanes, peak4);
+        peak = max(max(lanes[0], lanes[1]), max(lanes[2], lanes[3]));
+        _mm_storeu_ps(lanes, sum4);
+        sumSquares += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#   endif
+    for (; i < n; ++i) {
+        out[i] = in[i] * gains[i];
+        peak = max(peak, fabsf(out[i]));
+        sumSquares += out[i] * out[i];
+    }
+    return peak;
+}
+
+static float peakOf(const Sample* s, int n) {
+    int i = 0;
+    float peak = 0.0f;
+#   ifdef SUBSTEP_SSE
+        const __m128 signBit = _mm_set1_ps(-0.0f);
+        __m128 peak4 = _mm_setzero_ps();
+        for (; i + 4 <= n; i += 4) {
+            peak4 = _mm_max_ps(peak4, _mm_andnot_ps(signBit, _mm_loadu_ps(s + i)));
+        }
+        float lanes[4];
+        _mm_storeu_ps(lanes, peak4);
+        peak = max(max(lanes[0], lanes[1]), max(lanes[2], lanes[3]));
+#   endif
+    for (; i < n; ++i) {
+        peak = max(peak, fabsf(s[i]));
+    }
+    return peak;
+}
+
+MasterBus::MasterBus(int sampleRate, int channelCount) :
+        m_gain(DEFAULT_GAIN),
+        m_softClip(false),
+        m_releaseTime(DEFAULT_RELEASE_TIME),
+        m_peak(0.0f),
+        m_rms(0.0f),
+        m_gainReduction(1.0f),
+        m_ceiling(CEILING) {
+    setFormat(sampleRate, channelCount);
+}
+
+void MasterBus::setFormat(int sampleRate, int channelCount) {
+    m_sampleRate   = sampleRate;
+    m_channelCount = channelCount;
+    // Forces the release coefficient to be recomputed
+    m_releaseCoefficientTime = -1.0f;
+    m_releaseCoefficient     = 1.0f;
+
+    m_ring.resize(RING_FRAMES * channelCount);
+    System::memset(m_ring.getCArray(), 0, sizeof(Sample) * m_ring.size());
+    m_sampleGains.resize(CHUNK_SIZE * channelCount);
+    m_writeIndex = 0;
+    for (int c = 0; c < WINDOW_CHUNKS; ++c) {
+        m_requiredGain[c] = 1.0f;
+    }
+    m_chunkStartGain = 1.0f;
+    m_chunkEndGain   = 1.0f;
+}
+
+void MasterBus::finishChunk() {
+    const float chunkPeak = peakOf(m_ring.getCArray() + ((m_writeIndex - CHUNK_SIZE) & (RING_FRAMES - 1)) * m_channelCount,
+                                   CHUNK_SIZE * m_channelCount);
+    for (int c = 0; c < WINDOW_CHUNKS - 1; ++c) {
+        m_requiredGain[c] = m_requiredGain[c + 1];
+    }
+    m_requiredGain[WINDOW_CHUNKS - 1] = (chunkPeak > m_ceiling) ? m_ceiling / chunkPeak : 1.0f;
+
+    // m_requiredGain[0] is the chunk about to be output and m_requiredGain[d]
+    // the one d chunks after it. Falling 1/d of the way to each of them per
+    // chunk reaches every one of them exactly in time, and recovering never
+    // rises above any of them.
+    const float g = m_chunkEndGain;
+    float next = min(g + (1.0f - g) * m_releaseCoefficient, m_requiredGain[0]);
+    for (int d = 1; d < WINDOW_CHUNKS; ++d) {
+        const float r = m_requiredGain[d];
+        next = min(next, (r < g) ? g + (r - g) / float(d) : r);
+    }
+    m_chunkStartGain = g;
+    m_chunkEndGain   = next;
+}
+
+void MasterBus::process(Sample* samples, int frameCount) {
+    const float gain = m_gain.load(std::memory_order_relaxed);
+    const bool  clip = m_softClip.load(std::memory_order_relaxed);
+    const float releaseTime = m_releaseTime.load(std::memory_order_relaxed);
+    if (releaseTime != m_releaseCoefficientTime) {
+        m_releaseCoefficientTime = releaseTime;
+        m_releaseCoefficient = 1.0f - expf(-float(CHUNK_SIZE) / max(releaseTime * m_sampleRate, 1.0f));
+    }
+
+    const int channels = m_channelCount;
+    Sample* ring = m_ring.getCArray();
+    float peak = 0.0f;
+    float sumSquares = 0.0f;
+    int f = 0;
+    while (f < frameCount) {
+        // Chunks never straddle the end of the ring, and latency() is a whole
+        // number of chunks, so both the write and the delayed read are contiguous
+        const int offset = int(m_writeIndex & (CHUNK_SIZE - 1));
+        const int n = min(CHUNK_SIZE - offset, frameCount - f);
+        Sample* s = samples + f * channels;
+
+        applyGain(ring + (m_writeIndex & (RING_FRAMES - 1)) * channels, s, n * channels, gain, clip);
+
+        const Sample* delayed = ring + ((m_writeIndex - latency()) & (RING_FRAMES - 1)) * channels;
+        const float step  = (m_chunkEndGain - m_chunkStartGain) / float(CHUNK_SIZE);
+        const float start = m_chunkStartGain + step * float(offset + 1);
+        if (channels == 1) {
+            peak = max(peak, applyRamp(s, delayed, n, start, step, sumSquares));
+        } else {
+            Sample* g = m_sampleGains.getCArray();
+            for (int i = 0; i < n; ++i) {
+                for (int c = 0; c < channels; ++c) {
+                    g[i * channels + c] = start + float(i) * step;
+                }
+            }
+            peak = max(peak, applyGains(s, delayed, n * channels, g, sumSquares));
+        }
+
+        m_writeIndex += n;
+        f += n;
+        if ((m_writeIndex & (CHUNK_SIZE - 1)) == 0) {
+            finishChunk();
+        }
+    }
+
+    m_peak.store(peak, std::memory_order_relaxed);
+    m_rms.store(sqrtf(sumSquares / float(max(frameCount * channels, 1))), std::memory_order_relaxed);
+    m_gainReduction.store(m_chunkEndGain, std::memory_order_relaxed);
+}
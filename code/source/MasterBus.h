@@ -0,0 +1,126 @@
+#ifndef MasterBus_h
+#define MasterBus_h
+#include <G3D/G3DAll.h>
+#include <atomic>
+#include "util.h"
+
+/**
+    Final stage of the mix: a master gain, optional soft clipping and a
+    look-ahead peak limiter that keeps the output under ceiling() no matter
+    how many voices are playing.
+
+    The limiter works on chunks of CHUNK_SIZE frames, and links all channels:
+    each frame gets the same gain on every channel, so limiting never shifts
+    the stereo image. The signal is delayed by
+    latency() samples so that the gain can start falling up to
+    LOOKAHEAD_CHUNKS chunks before a peak arrives, ramping linearly so that
+    it reaches exactly the required reduction in time, and then recovers
+    exponentially. Only setFormat() allocates.
+
+    process() must only be called from one thread at a time. The settings and
+    meters are atomics, so any thread may adjust or read them while it runs.
+ */
+class MasterBus {
+public:
+    static const int CHUNK_SIZE       = 16;
+    static const int LOOKAHEAD_CHUNKS = 4;
+
+private:
+    /** Power of two holding latency() frames plus the chunk being filled */
+    static const int RING_FRAMES      = 128;
+    /** Chunks whose required gains are remembered: the look-ahead window plus the output chunk */
+    static const int WINDOW_CHUNKS    = LOOKAHEAD_CHUNKS + 1;
+
+    std::atomic<float>  m_gain;
+    std::atomic<bool>   m_softClip;
+    std::atomic<float>  m_releaseTime;
+
+    std::atomic<float>  m_peak;
+    std::atomic<float>  m_rms;
+    std::atomic<float>  m_gainReduction;
+
+    int     m_sampleRate;
+    int     m_channelCount;
+    float   m_ceiling;
+    /** Per-chunk recovery toward unity gain */
+    float   m_releaseCoefficient;
+    float   m_releaseCoefficientTime;
+
+    /** Delay line of gained, clipped input: RING_FRAMES interleaved frames */
+    Array<Sample> m_ring;
+    /** Per-sample limiter gains for the chunk being output. Only used with
+        more than one channel */
+    Array<Sample> m_sampleGains;
+    /** Total frames written. Only used masked, so wrapping around is harmless */
+    uint32  m_writeIndex;
+
+    /** Highest gain that keeps each of the last WINDOW_CHUNKS input chunks
+        under the ceiling, oldest first */
+    float   m_requiredGain[WINDOW_CHUNKS];
+    /** Limiter gain at the start and end of the chunk being output */
+    float   m_chunkStartGain;
+    float   m_chunkEndGain;
+
+    /** Moves on to the next output chunk once the input chunk has filled */
+    void finishChunk();
+
+public:
+    explicit MasterBus(int sampleRate = 48000, int channelCount = 1);
+
+    /** Clears the delay line and the limiter state. Allocates */
+    void setFormat(int sampleRate, int channelCount);
+
+    /** Linear gain applied to the mix before clipping and limiting */
+    void setGain(float g) {
+        m_gain.store(g, std::memory_order_relaxed);
+    }
+
+    float gain() const {
+        return m_gain.load(std::memory_order_relaxed);
+    }
+
+    /** Rounds off peaks with a tanh-like curve before the limiter, which
+        then has less to do */
+    void setSoftClip(bool b) {
+        m_softClip.store(b, std::memory_order_relaxed);
+    }
+
+    bool softClip() const {
+        return m_softClip.load(std::memory_order_relaxed);
+    }
+
+    /** Seconds for the limiter to recover most of the way to unity gain */
+    void setReleaseTime(float t) {
+        m_releaseTime.store(t, std::memory_order_relaxed);
+    }
+
+    /** Largest absolute output value */
+    float ceiling() const {
+        return m_ceiling;
+    }
+
+    /** Frames by which the output lags the input */
+    static int latency() {
+        return (LOOKAHEAD_CHUNKS + 1) * CHUNK_SIZE;
+    }
+
+    /** Processes \a frameCount interleaved frames in place */
+    void process(Sample* samples, int frameCount);
+
+    /** Largest absolute output value in the last process() call */
+    float peak() const {
+        return m_peak.load(std::memory_order_relaxed);
+    }
+
+    /** RMS of the output over the last process() call */
+    float rms() const {
+        return m_rms.load(std::memory_order_relaxed);
+    }
+
+    /** Limiter gain at the end of the last process() call, in (0, 1] */
+    float gainReduction() const {
+        return m_gainReduction.load(std::memory_order_relaxed);
+    }
+};
+
+#endif
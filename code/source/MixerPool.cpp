@@ -0,0 +1,109 @@
+#include "MixerPool.h"
+#include "util.h"
+#ifdef _WIN32
+#   include <windows.h>
+#else
+#   include <pthread.h>
+#   include <sched.h>
+#endif
+
+/** Polls before a waiting worker goes to sleep; a few tens of microseconds */
+static const int SPIN_COUNT = 4000;
+
+static inline void cpuRelax() {
+#   ifdef SUBSTEP_SSE
+        _mm_pause();
+#   else
+        std::this_thread::yield();
+#   endif
+}
+
+/** Best effort: without the privilege to do so the thread keeps its priority */
+static void raisePriority(std::thread& t) {
+#   ifdef _WIN32
+        SetThreadPriority(t.native_handle(), THREAD_PRIORITY_TIME_CRITICAL);
+#   else
+        sched_param param;
+        param.sched_priority = sched_get_priority_min(SCHED_FIFO) + 1;
+        pthread_setschedparam(t.native_handle(), SCHED_FIFO, &param);
+#   endif
+}
+
+shared_ptr<MixerPool> MixerPool::create(int participantCount) {
+    return shared_ptr<MixerPool>(new MixerPool(max(participantCount - 1, 0)));
+}
+
+MixerPool::MixerPool(int workerCount) :
+        m_generation(0),
+        m_sleepers(0),
+        m_remaining(0),
+        m_quit(false),
+        m_job(NULL),
+        m_context(NULL) {
+    for (int w = 0; w < workerCount; ++w) {
+        m_workers.push_back(std::thread(&MixerPool::workerLoop, this, w + 1));
+        raisePriority(m_workers.back());
+    }
+}
+
+MixerPool::~MixerPool() {
+    m_quit = true;
+    m_generation.fetch_add(1);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_wake.notify_all();
+    }
+    for (std::thread& worker : m_workers) {
+        worker.join();
+    }
+}
+
+void MixerPool::workerLoop(int participant) {
+    uint32 seen = 0;
+    while (true) {
+        uint32 generation = m_generation.load(std::memory_order_acquire);
+        for (int spin = 0; (generation == seen) && (spin < SPIN_COUNT); ++spin) {
+            cpuRelax();
+            generation = m_generation.load(std::memory_order_acquire);
+        }
+        if (generation == seen) {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            // Announced before the final check: run() bumps the generation
+            // before reading m_sleepers, so one of the two sees the other
+            ++m_sleepers;
+            m_wake.wait(lock, [&]() { return m_generation.load() != seen; });
+            --m_sleepers;
+            generation = m_generation.load(std::memory_order_acquire);
+        }
+        seen = generation;
+
+        if (m_quit) {
+            return;
+        }
+        m_job(m_context, participant);
+        m_remaining.fetch_sub(1, std::memory_order_release);
+    }
+}
+
+void MixerPool::run(Job job, void* context) {
+    m_job     = job;
+    m_context = context;
+    m_remaining.store(int(m_workers.size()), std::memory_order_relaxed);
+    m_generation.fetch_add(1);
+    if (m_sleepers.load() > 0) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_wake.notify_all();
+    }
+
+    job(context, 0);
+
+    // Workers finish at about the same time as this thread, so spin, but
+    // yield after a while in case one of them was preempted
+    for (int spin = 0; m_remaining.load(std::memory_order_acquire) > 0; ++spin) {
+        if (spin < SPIN_COUNT) {
+            cpuRelax();
+        } else {
+            std::this_thread::yield();
+        }
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef MixerPool_h
+#define MixerPool_h
+#include <G3D/G3DAll.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+    A fixed set of worker threads for splitting one audio callback's work
+    across cores.
+
+    The workers are spawned once, at raised priority where the platform
+    allows it. Between jobs they spin briefly, so back-to-back jobs start
+    immediately, and then sleep on a condition variable (a futex on Linux),
+    so an idle pool costs nothing. run() never allocates and only takes a
+    lock when a worker has gone to sleep.
+ */
+class MixerPool {
+public:
+    /** Called once per participant with its index, from its own thread */
+    typedef void (*Job)(void* context, int participant);
+
+private:
+    /** std::vector because G3D::Array copies its elements and threads are move-only */
+    std::vector<std::thread>    m_workers;
+
+    std::mutex                  m_mutex;
+    std::condition_variable     m_wake;
+    /** Incremented once per job; workers run a job when it changes */
+    std::atomic<uint32>         m_generation;
+    /** Workers blocked on m_wake, so run() can skip notifying when none are */
+    std::atomic<int>            m_sleepers;
+    /** Workers still running the current job */
+    std::atomic<int>            m_remaining;
+    std::atomic<bool>           m_quit;
+
+    Job                         m_job;
+    void*                       m_context;
+
+    explicit MixerPool(int workerCount);
+
+    void workerLoop(int participant);
+
+public:
+    /** \a participantCount includes the thread calling run(), so it spawns
+        participantCount - 1 workers */
+    static shared_ptr<MixerPool> create(int participantCount);
+
+    ~MixerPool();
+
+    int participantCount() const {
+        return int(m_workers.size()) + 1;
+    }
+
+    /** Runs job(context, i) for every i in [0, participantCount()). The
+        calling thread runs participant 0. Returns once all have finished.
+        Must not be called from more than one thread at a time. */
+    void run(Job job, void* context);
+};
+
+#endif
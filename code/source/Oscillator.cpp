@@ -0,0 +1,111 @@
+#include "Oscillator.h"
+
+static const float PHASE_SCALE = 1.0f / 4294967296.0f;
+
+/** Phase as a float in [0, 1). Dropping the low bits first keeps it exact,
+    so it never rounds up to 1 */
+static inline float phaseFraction(uint32 phase) {
+    return float(phase >> 8) * (1.0f / 16777216.0f);
+}
+
+/** Above this the corrections of the two corners of a square or triangle
+    would overlap */
+static const float MAX_CORRECTED_INCREMENT = 0.25f;
+
+/**
+    PolyBLEP and PolyBLAMP residuals at phase t in [0, 1) for a corner at
+    phase 0. \a after and \a before are 1 - (distance to the corner in
+    samples), positive only within a sample of it.
+
+    blep is the correction for a unit downward jump, blamp for a unit
+    increase in slope per sample.
+ */
+static inline float blep(float after, float before) {
+    return 0.5f * (after * after - before * before);
+}
+
+static inline float blamp(float after, float before) {
+    return (after * after * after + before * before * before) * (1.0f / 6.0f);
+}
+
+static inline float oscillatorSample(Oscillator::Shape shape, float t, float dt, float invDt) {
+    const float after  = max(1.0f - t * invDt, 0.0f);
+    const float before = max(1.0f - (1.0f - t) * invDt, 0.0f);
+    if (shape == Oscillator::Shape::SAW) {
+        return 2.0f * t - 1.0f + 2.0f * blep(after, before);
+    }
+    // The second corner, half a cycle later
+    const float t2      = (t < 0.5f) ? t + 0.5f : t - 0.5f;
+    const float after2  = max(1.0f - t2 * invDt, 0.0f);
+    const float before2 = max(1.0f - (1.0f - t2) * invDt, 0.0f);
+    if (shape == Oscillator::Shape::SQUARE) {
+        return ((t < 0.5f) ? 1.0f : -1.0f) - 2.0f * blep(after, before) + 2.0f * blep(after2, before2);
+    }
+    // Triangle: the slope goes from -4 to +4 per cycle at phase 0 and back at 0.5
+    return 1.0f - 4.0f * abs(t - 0.5f) + 8.0f * dt * (blamp(after, before) - blamp(after2, before2));
+}
+
+#ifdef SUBSTEP_SSE
+static inline __m128 blep4(__m128 after, __m128 before) {
+    return _mm_mul_ps(_mm_set1_ps(0.5f), _mm_sub_ps(_mm_mul_ps(after, after), _mm_mul_ps(before, before)));
+}
+
+static inline __m128 blamp4(__m128 after, __m128 before) {
+    const __m128 a3 = _mm_mul_ps(_mm_mul_ps(after, after), after);
+    const __m128 b3 = _mm_mul_ps(_mm_mul_ps(before, before), before);
+    return _mm_mul_ps(_mm_set1_ps(1.0f / 6.0f), _mm_add_ps(a3, b3));
+}
+
+/** after and before for four phases */
+static inline void distances4(__m128 t, __m128 invDt, __m128& after, __m128& before) {
+    const __m128 one  = _mm_set1_ps(1.0f);
+    const __m128 zero = _mm_setzero_ps();
+    after  = _mm_max_ps(_mm_sub_ps(one, _mm_mul_ps(t, invDt)), zero);
+    before = _mm_max_ps(_mm_sub_ps(one, _mm_mul_ps(_mm_sub_ps(one, t), invDt)), zero);
+}
+#endif
+
+void Oscillator::render(Shape shape, Sample* dst, int count, uint32& phase, uint32 increment) {
+    const float dt    = min(float(increment) * PHASE_SCALE, MAX_CORRECTED_INCREMENT);
+    const float invDt = 1.0f / max(dt, 1e-9f);
+    int i = 0;
+#   ifdef SUBSTEP_SSE
+        const __m128 one    = _mm_set1_ps(1.0f);
+        const __m128 half   = _mm_set1_ps(0.5f);
+        const __m128 two    = _mm_set1_ps(2.0f);
+        const __m128 invDt4 = _mm_set1_ps(invDt);
+        const float  step   = float(increment) * PHASE_SCALE;
+        const __m128 lanes  = _mm_set_ps(3.0f * step, 2.0f * step, step, 0.0f);
+        for (; i + 4 <= count; i += 4) {
+            // Lanes start from the exact integer phase, so rounding never accumulates
+            __m128 t = _mm_add_ps(_mm_set1_ps(phaseFraction(phase)), lanes);
+            t = _mm_sub_ps(t, _mm_and_ps(_mm_cmpge_ps(t, one), one));
+            phase += 4 * increment;
+
+            __m128 after, before;
+            distances4(t, invDt4, after, before);
+            __m128 v;
+            if (shape == Shape::SAW) {
+                v = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(two, t), one), _mm_mul_ps(two, blep4(after, before)));
+            } else {
+                const __m128 firstHalf = _mm_cmplt_ps(t, half);
+                const __m128 t2 = _mm_add_ps(t, _mm_or_ps(_mm_and_ps(firstHalf, half), _mm_andnot_ps(firstHalf, _mm_set1_ps(-0.5f))));
+                __m128 after2, before2;
+                distances4(t2, invDt4, after2, before2);
+                if (shape == Shape::SQUARE) {
+                    const __m128 naive = _mm_or_ps(_mm_and_ps(firstHalf, one), _mm_andnot_ps(firstHalf, _mm_set1_ps(-1.0f)));
+                    v = _mm_add_ps(naive, _mm_mul_ps(two, _mm_sub_ps(blep4(after2, before2), blep4(after, before))));
+                } else {
+                    const __m128 distance = _mm_andnot_ps(_mm_set1_ps(-0.0f), _mm_sub_ps(t, half));
+                    const __m128 naive = _mm_sub_ps(one, _mm_mul_ps(_mm_set1_ps(4.0f), distance));
+                    v = _mm_add_ps(naive, _mm_mul_ps(_mm_set1_ps(8.0f * dt), _mm_sub_ps(blamp4(after, before), blamp4(after2, before2))));
+                }
+            }
+            _mm_storeu_ps(dst + i, v);
+        }
+#   endif
+    for (; i < count; ++i) {
+        dst[i] = oscillatorSample(shape, phaseFraction(phase), dt, invDt);
+        phase += increment;
+    }
+}
@@ -0,0 +1,26 @@
+#ifndef Oscillator_h
+#define Oscillator_h
+#include <G3D/G3DAll.h>
+#include "util.h"
+
+/**
+    Band-limited saw, square and triangle waves computed directly from a
+    phase, so they need no tables and nothing is rendered ahead of time.
+
+    The naive waveform aliases at its corners. Each jump is smoothed with a
+    two-sample PolyBLEP (a polynomial band-limited step) and each change of
+    slope with the matching PolyBLAMP (band-limited ramp), which pushes the
+    aliasing well below the harmonics at a cost of a few multiplies per
+    sample. Blocks render four samples at a time with SSE.
+ */
+class Oscillator {
+public:
+    G3D_DECLARE_ENUM_CLASS(Shape, SAW, SQUARE, TRIANGLE);
+
+    /** \a phase is a 32-bit fraction of a cycle and advances by \a increment
+        per sample. Each shape starts a cycle at phase 0 and spans [-1, 1].
+        Corrections assume pitches below a quarter of the sample rate */
+    static void render(Shape shape, Sample* dst, int count, uint32& phase, uint32 increment);
+};
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef PlayHead_h
+#define PlayHead_h
+#include <G3D/G3DAll.h>
+
+/** The first four are the square lattice's. The hex lattice adds the two
+    diagonals: it is a square grid with one diagonal per cell, so in
+    (x, y) its six neighbors are the four square ones, (-1, 1) and (1, -1) */
+G3D_DECLARE_ENUM_CLASS(Direction, UP, DOWN, LEFT, RIGHT, UP_LEFT, DOWN_RIGHT);
+
+
+struct PlayHead {
+    Vector2int16 position;
+    Direction direction;
+
+    PlayHead() : position(Vector2int16(0,0)), direction(Direction::RIGHT) {}
+    PlayHead(int x, int y, Direction d = Direction::RIGHT) : position(Vector2int16(x,y)), direction(d){}
+};
+
+/** Step of each Direction, indexed by its value */
+static const int DIRECTION_X[] = { 0,  0, -1, 1, -1,  1 };
+static const int DIRECTION_Y[] = { 1, -1,  0, 0,  1, -1 };
+
+/** Each Direction reversed */
+static const Direction::Value OPPOSITE[] = {
+    Direction::DOWN, Direction::UP, Direction::RIGHT, Direction::LEFT, Direction::DOWN_RIGHT, Direction::UP_LEFT };
+
+inline Vector2int16 vecFromDir(Direction d) {
+    return Vector2int16(DIRECTION_X[d], DIRECTION_Y[d]);
+}
+
+inline Direction opposite(Direction d) {
+    return OPPOSITE[d];
+}
+
+inline bool isVert(Direction d) {
+    return d == Direction::UP || d == Direction::DOWN;
+}
+
+#endif
@@ -0,0 +1,97 @@
+#include "PlayheadBatch.h"
+
+void PlayheadBatch::appendHeads(const Array<PlayHead>& heads, const GridMapping& mapping,
+        const GridMapping::Shift& shift, float halfSize, Array<Vector4>& instances) {
+
+    const int first = instances.size();
+    instances.resize(first + heads.size());
+    Vector4* out = instances.getCArray() + first;
+
+    // Each task writes its own range of the output, so none need a lock
+    const int blockCount = (heads.size() + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    Thread::runConcurrently(0, blockCount, [&](int block) {
+        const int end = min((block + 1) * BLOCK_SIZE, heads.size());
+        for (int i = block * BLOCK_SIZE; i < end; ++i) {
+            out[i] = Vector4(mapping.headPoint(heads[i], shift), halfSize);
+        }
+    }, blockCount <= 1);
+}
+
+void PlayheadBatch::appendSplats(const Array<PlayHead>& heads, const GridMapping& mapping, int stride,
+        float halfSize, Array<Vector4>& instances) {
+
+    const int blocksWide = (mapping.width()  + stride - 1) / stride;
+    const int blocksHigh = (mapping.height() + stride - 1) / stride;
+    m_blockCounts.resize(blocksWide * blocksHigh);
+    System::memset(m_blockCounts.getCArray(), 0, sizeof(int) * m_blockCounts.size());
+    for (const PlayHead& head : heads) {
+        ++m_blockCounts[(head.position.y / stride) * blocksWide + head.position.x / stride];
+    }
+
+    for (int by = 0; by < blocksHigh; ++by) {
+        for (int bx = 0; bx < blocksWide; ++bx) {
+            const int count = m_blockCounts[by * blocksWide + bx];
+            if (count > 0) {
+                const Point3 center = mapping.node(min(bx * stride + stride / 2, mapping.width() - 1),
+                                                   min(by * stride + stride / 2, mapping.height() - 1));
+                // Area grows with the count
+                instances.append(Vector4(center, halfSize * min(sqrtf(float(count)), float(stride))));
+            }
+        }
+    }
+}
+
+void PlayheadBatch::makeCube() {
+    // Two triangles on each face of [-1, 1]^3
+    static const int faces[6][4] = {
+        {0, 1, 3, 2}, {4, 6, 7, 5}, {0, 4, 5, 1},
+        {2, 3, 7, 6}, {0, 2, 6, 4}, {1, 5, 7, 3}};
+    Array<Vector3> vertices;
+    for (int f = 0; f < 6; ++f) {
+        static const int corners[6] = {0, 1, 2, 0, 2, 3};
+        for (int c : corners) {
+            const int v = faces[f][c];
+            vertices.append(Vector3((v & 4) ? 1.0f : -1.0f, (v & 2) ? 1.0f : -1.0f, (v & 1) ? 1.0f : -1.0f));
+        }
+    }
+    m_cubeBuffer = VertexBuffer::create(sizeof(Vector3) * vertices.size() + 16, VertexBuffer::WRITE_ONCE);
+    m_cube = AttributeArray(vertices, m_cubeBuffer);
+}
+
+void PlayheadBatch::reserveTexture(int count) {
+    if (notNull(m_instanceTexture) && (m_instanceTexture->width() * m_instanceTexture->height() >= count)) {
+        return;
+    }
+    const int width  = min(ceilPow2(count), int(TEXTURE_WIDTH));
+    const int height = ceilPow2((count + width - 1) / width);
+    m_instanceTexture = Texture::createEmpty("PlayheadBatch::instances", width, height,
+        ImageFormat::RGBA32F(), Texture::DIM_2D, false);
+}
+
+void PlayheadBatch::draw(RenderDevice*, const Color3& color) {
+    const int count = m_instances.size();
+    if (count == 0) {
+        return;
+    }
+    if (isNull(m_cubeBuffer)) {
+        makeCube();
+    }
+
+    // Pad out the texture, whose unused texels the shader never reads
+    reserveTexture(count);
+    const int width  = m_instanceTexture->width();
+    const int height = m_instanceTexture->height();
+    m_instances.resize(width * height);
+    m_instanceTexture->update(CPUPixelTransferBuffer::fromData(width, height, ImageFormat::RGBA32F(), m_instances.getCArray()));
+
+    Args args;
+    args.setPrimitiveType(PrimitiveType::TRIANGLES);
+    args.setAttributeArray("g3d_Vertex", m_cube);
+    args.setUniform("instances", m_instanceTexture, Sampler::buffer());
+    args.setUniform("instanceTextureWidth", width);
+    args.setUniform("color", color);
+    args.setNumInstances(count);
+    LAUNCH_SHADER("PlayheadBatch.*", args);
+
+    m_instances.fastClear();
+}
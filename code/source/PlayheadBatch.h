@@ -0,0 +1,71 @@
+#ifndef PlayheadBatch_h
+#define PlayheadBatch_h
+#include <G3D/G3DAll.h>
+#include "GridMapping.h"
+
+/**
+    Draws every moving head and collision marker in a frame as instances of
+    one cube, with a single draw call, instead of a Draw::box each.
+
+    Each instance is a Vector4 holding its center and half size. The
+    instances are uploaded once per frame into a float texture that the
+    shader indexes by instance number. The texture is kept, and only
+    reallocated when it must grow.
+
+    The builders only touch CPU memory, so they can be run and timed without
+    a window. appendHeads() splits large head counts across cores. When
+    cells are too small on screen for single heads to be seen,
+    appendSplats() draws each block of cells as one splat sized by how many
+    heads it holds.
+
+    Main thread only.
+ */
+class PlayheadBatch {
+public:
+    /** Heads placed per task by appendHeads(). Fewer than this are placed on
+        the calling thread */
+    static const int BLOCK_SIZE = 2048;
+
+    /** Width of the instance texture, within every GPU's limit */
+    static const int TEXTURE_WIDTH = 4096;
+
+private:
+    Array<Vector4> m_instances;
+
+    /** Heads per block, scratch for appendSplats() */
+    Array<int> m_blockCounts;
+
+    /** Unit cube, TRIANGLES, built on the first draw() */
+    shared_ptr<VertexBuffer> m_cubeBuffer;
+    AttributeArray          m_cube;
+
+    /** Holds the instances. Both sides are powers of two, so it seldom grows */
+    shared_ptr<Texture>     m_instanceTexture;
+
+    void makeCube();
+
+    /** Makes m_instanceTexture hold at least \a count instances */
+    void reserveTexture(int count);
+
+public:
+    /** Appends an instance for each of \a heads, moved by \a shift toward
+        its next cell */
+    static void appendHeads(const Array<PlayHead>& heads, const GridMapping& mapping,
+        const GridMapping::Shift& shift, float halfSize, Array<Vector4>& instances);
+
+    /** Appends an instance for each \a stride x \a stride block of cells
+        holding any of \a heads, at its middle node. A block with one head
+        gets \a halfSize and a full one the whole block */
+    void appendSplats(const Array<PlayHead>& heads, const GridMapping& mapping, int stride,
+        float halfSize, Array<Vector4>& instances);
+
+    /** Instances for the next draw() */
+    Array<Vector4>& instances() {
+        return m_instances;
+    }
+
+    /** Draws the instances in \a color and removes them */
+    void draw(RenderDevice* rd, const Color3& color);
+};
+
+#endif
@@ -0,0 +1,138 @@
+#include "Resampler.h"
+
+struct ResamplerPreset {
+    int   taps;
+    int   phaseCount;
+    float kaiserBeta;
+    /** Cutoff as a fraction of the lower of the two Nyquist rates */
+    float rolloff;
+    ResamplerPreset(int t, int p, float beta, float r) :
+        taps(t), phaseCount(p), kaiserBeta(beta), rolloff(r) {}
+};
+
+static ResamplerPreset presetFor(Resampler::Quality q) {
+    switch (q) {
+    case Resampler::Quality::FAST:
+        return ResamplerPreset(8, 32, 5.0f, 0.85f);
+    case Resampler::Quality::STANDARD:
+        return ResamplerPreset(16, 128, 7.0f, 0.92f);
+    case Resampler::Quality::HIGH:
+        return ResamplerPreset(32, 512, 9.0f, 0.96f);
+    default:
+        alwaysAssertM(false, "Invalid resampler quality");
+        return ResamplerPreset(16, 128, 7.0f, 0.92f);
+    }
+}
+
+/** Zeroth order modified Bessel function of the first kind, for the Kaiser window */
+static double besselI0(double x) {
+    double sum  = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 50; ++k) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum  += term;
+        if (term < sum * 1e-12) {
+            break;
+        }
+    }
+    return sum;
+}
+
+static double sinc(double x) {
+    return (abs(x) < 1e-9) ? 1.0 : sin(pi() * x) / (pi() * x);
+}
+
+Resampler::Resampler(int inputRate, int outputRate, Quality quality) :
+        m_inputRate(inputRate), m_outputRate(outputRate), m_quality(quality) {
+    alwaysAssertM(inputRate > 0 && outputRate > 0, "Sample rates must be positive");
+    const ResamplerPreset preset = presetFor(quality);
+    m_step       = double(inputRate) / double(outputRate);
+    m_taps       = preset.taps;
+    m_phaseCount = preset.phaseCount;
+
+    const double cutoff   = min(1.0, double(outputRate) / double(inputRate)) * preset.rolloff;
+    const double halfTaps = m_taps / 2;
+    const double i0Beta   = besselI0(preset.kaiserBeta);
+
+    m_kernel.resize((m_phaseCount + 1) * m_taps);
+    for (int p = 0; p <= m_phaseCount; ++p) {
+        const double frac = double(p) / m_phaseCount;
+        float* row = m_kernel.getCArray() + p * m_taps;
+        double sum = 0.0;
+        for (int k = 0; k < m_taps; ++k) {
+            // Distance in input samples from the read position to tap k
+            const double d = k - (halfTaps - 1.0) - frac;
+            const double r = d / halfTaps;
+            const double window = (abs(r) <= 1.0) ? besselI0(preset.kaiserBeta * sqrt(1.0 - r * r)) / i0Beta : 0.0;
+            const double h = cutoff * sinc(cutoff * d) * window;
+            row[k] = float(h);
+            sum += h;
+        }
+        // Normalize every phase to unity DC gain so interpolating between
+        // phases cannot introduce a ripple at the phase rate
+        for (int k = 0; k < m_taps; ++k) {
+            row[k] = float(row[k] / sum);
+        }
+    }
+}
+
+shared_ptr<Resampler> Resampler::create(int inputRate, int outputRate, Quality quality) {
+    return shared_ptr<Resampler>(new Resampler(inputRate, outputRate, quality));
+}
+
+/** s0 = x.k0, s1 = x.k1 over n floats, n a multiple of 4 */
+static inline void dot2(const float* x, const float* k0, const float* k1, int n, float& s0, float& s1) {
+#   ifdef SUBSTEP_SSE
+        __m128 a0 = _mm_setzero_ps();
+        __m128 a1 = _mm_setzero_ps();
+        for (int i = 0; i < n; i += 4) {
+            const __m128 v = _mm_loadu_ps(x + i);
+            a0 = _mm_add_ps(a0, _mm_mul_ps(v, _mm_loadu_ps(k0 + i)));
+            a1 = _mm_add_ps(a1, _mm_mul_ps(v, _mm_loadu_ps(k1 + i)));
+        }
+        float r0[4], r1[4];
+        _mm_storeu_ps(r0, a0);
+        _mm_storeu_ps(r1, a1);
+        s0 = (r0[0] + r0[1]) + (r0[2] + r0[3]);
+        s1 = (r1[0] + r1[1]) + (r1[2] + r1[3]);
+#   else
+        float a0 = 0.0f, a1 = 0.0f;
+        for (int i = 0; i < n; ++i) {
+            a0 += x[i] * k0[i];
+            a1 += x[i] * k1[i];
+        }
+        s0 = a0;
+        s1 = a1;
+#   endif
+}
+
+int Resampler::addTo(const Sample* input, int inputCount, double& position, Sample* output, int outputCount) const {
+    const double end      = endPosition(inputCount);
+    const int    halfTaps = m_taps / 2;
+    int i = 0;
+    for (; (i < outputCount) && (position < end); ++i) {
+        const int    base   = int(floor(position));
+        const float  phaseF = float(position - base) * m_phaseCount;
+        const int    phase  = min(int(phaseF), m_phaseCount - 1);
+        const float  alpha  = phaseF - phase;
+        const float* k0     = m_kernel.getCArray() + phase * m_taps;
+        const float* k1     = k0 + m_taps;
+        const int    first  = base - halfTaps + 1;
+
+        float s0 = 0.0f, s1 = 0.0f;
+        if ((first >= 0) && (first + m_taps <= inputCount)) {
+            dot2(input + first, k0, k1, m_taps, s0, s1);
+        } else {
+            // Only the first and last few outputs of a sample overlap its edges
+            const int kBegin = max(0, -first);
+            const int kEnd   = min(m_taps, inputCount - first);
+            for (int k = kBegin; k < kEnd; ++k) {
+                s0 += input[first + k] * k0[k];
+                s1 += input[first + k] * k1[k];
+            }
+        }
+        output[i] += s0 + (s1 - s0) * alpha;
+        position  += m_step;
+    }
+    return i;
+}
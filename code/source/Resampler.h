@@ -0,0 +1,74 @@
+#ifndef Resampler_h
+#define Resampler_h
+#include <G3D/G3DAll.h>
+#include "util.h"
+
+/** 
+    Polyphase windowed-sinc sample rate converter.
+
+    The Kaiser-windowed sinc kernel is tabulated once at construction for
+    a fixed input/output rate pair; rendering linearly interpolates between
+    adjacent kernel phases, so any fractional read position is supported and
+    the cost per output sample is two dot products of taps() floats. When
+    downsampling the cutoff is lowered to the output Nyquist rate.
+
+    The Synthesizer owns one per input rate, and its voices point at it.
+ */
+class Resampler {
+public:
+    /** Trades CPU (taps per output sample) against stopband attenuation and passband width */
+    G3D_DECLARE_ENUM_CLASS(Quality, FAST, STANDARD, HIGH);
+
+private:
+    int          m_inputRate;
+    int          m_outputRate;
+    Quality      m_quality;
+    /** Input samples advanced per output sample */
+    double       m_step;
+    int          m_taps;
+    int          m_phaseCount;
+    /** (m_phaseCount + 1) rows of m_taps coefficients. Row p is the kernel for
+        fractional offset p / m_phaseCount; the extra row makes offset 1.0 valid */
+    Array<float> m_kernel;
+
+    Resampler(int inputRate, int outputRate, Quality quality);
+
+public:
+    static shared_ptr<Resampler> create(int inputRate, int outputRate, Quality quality = Quality::STANDARD);
+
+    int inputRate() const {
+        return m_inputRate;
+    }
+
+    int outputRate() const {
+        return m_outputRate;
+    }
+
+    Quality quality() const {
+        return m_quality;
+    }
+
+    double step() const {
+        return m_step;
+    }
+
+    int taps() const {
+        return m_taps;
+    }
+
+    /** Input position past the end of a \a inputCount sample buffer at which
+        the filter tail has fully decayed */
+    double endPosition(int inputCount) const {
+        return double(inputCount + m_taps / 2);
+    }
+
+    /** 
+      Adds up to \a outputCount resampled samples of \a input (treated as zero
+      outside [0, inputCount)) into \a output, reading from \a position onward
+      and advancing it by step() per sample. Stops early once \a position
+      reaches endPosition(inputCount). Returns the number of samples written.
+     */
+    int addTo(const Sample* input, int inputCount, double& position, Sample* output, int outputCount) const;
+};
+
+#endif
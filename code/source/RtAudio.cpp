@@ -9429,6 +9429,454 @@ static void *ossCallbackHandler( void *ptr )
 #endif
 
 
+#if defined(__RTAUDIO_DUMMY__)
+
+// The null API has no hardware to block on, so it drives the user
+// callback from its own thread.  NULL_CLOCK_DEVICE sleeps until each
+// buffer's deadline (computed from the frame count so it never
+// drifts), NULL_FILE_DEVICE never sleeps and appends every output
+// buffer to a file instead.
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <system_error>
+#include <cstdio>
+
+struct DummyHandle {
+  std::thread thread;
+  std::mutex mutex;
+  std::condition_variable runnable;
+  std::chrono::steady_clock::time_point startTime;
+  unsigned long long framesSinceStart;
+  bool freeRunning;
+  bool xrun;
+  FILE *file;
+  bool isWav;
+  unsigned long dataBytes;
+
+  DummyHandle()
+    :framesSinceStart(0), freeRunning(false), xrun(false), file(0), isWav(false), dataBytes(0) {}
+};
+
+static void dummyCallbackHandler( CallbackInfo *info );
+
+static void writeLittleEndian( FILE *file, unsigned long value, int bytes )
+{
+  for ( int i=0; i<bytes; i++ )
+    fputc( (int) ( ( value >> ( 8 * i ) ) & 0xff ), file );
+}
+
+// Writes a canonical 44 byte RIFF/WAVE header.  It is written once with
+// a zero data size when the file is opened and rewritten with the real
+// size when the stream is closed.  Note that WAVE defines 8-bit data as
+// unsigned, while RTAUDIO_SINT8 samples are written as signed.
+static void writeWavHeader( FILE *file, RtAudioFormat format, unsigned int channels,
+                            unsigned int sampleRate, unsigned int sampleBytes,
+                            unsigned long dataBytes )
+{
+  bool isFloat = ( format == RTAUDIO_FLOAT32 || format == RTAUDIO_FLOAT64 );
+  fwrite( "RIFF", 1, 4, file );
+  writeLittleEndian( file, 36 + dataBytes, 4 );
+  fwrite( "WAVEfmt ", 1, 8, file );
+  writeLittleEndian( file, 16, 4 );
+  writeLittleEndian( file, isFloat ? 3 : 1, 2 );
+  writeLittleEndian( file, channels, 2 );
+  writeLittleEndian( file, sampleRate, 4 );
+  writeLittleEndian( file, sampleRate * channels * sampleBytes, 4 );
+  writeLittleEndian( file, channels * sampleBytes, 2 );
+  writeLittleEndian( file, 8 * sampleBytes, 2 );
+  fwrite( "data", 1, 4, file );
+  writeLittleEndian( file, dataBytes, 4 );
+}
+
+RtApiDummy :: RtApiDummy()
+{
+  // Nothing to do here.
+}
+
+RtApiDummy :: ~RtApiDummy()
+{
+  if ( stream_.state != STREAM_CLOSED ) closeStream();
+}
+
+RtAudio::DeviceInfo RtApiDummy :: getDeviceInfo( unsigned int device )
+{
+  RtAudio::DeviceInfo info;
+  if ( device >= NULL_DEVICE_COUNT ) {
+    errorText_ = "RtApiDummy::getDeviceInfo: device ID is invalid!";
+    error( RtAudioError::INVALID_USE );
+    return info;
+  }
+
+  info.probed = true;
+  if ( device == NULL_CLOCK_DEVICE )
+    info.name = "Null Device (clock)";
+  else
+    info.name = "Null Device (file)";
+  info.outputChannels = 32;
+  info.inputChannels = 32;
+  info.duplexChannels = 32;
+  info.isDefaultOutput = ( device == NULL_CLOCK_DEVICE );
+  info.isDefaultInput = ( device == NULL_CLOCK_DEVICE );
+  for ( unsigned int i=0; i<MAX_SAMPLE_RATES; i++ )
+    info.sampleRates.push_back( SAMPLE_RATES[i] );
+  info.nativeFormats = RTAUDIO_SINT8 | RTAUDIO_SINT16 | RTAUDIO_SINT24 |
+    RTAUDIO_SINT32 | RTAUDIO_FLOAT32 | RTAUDIO_FLOAT64;
+  return info;
+}
+
+bool RtApiDummy :: probeDeviceOpen( unsigned int device, StreamMode mode, unsigned int channels,
+                                    unsigned int firstChannel, unsigned int sampleRate,
+                                    RtAudioFormat format, unsigned int *bufferSize,
+                                    RtAudio::StreamOptions *options )
+{
+  DummyHandle *handle = 0;
+  unsigned long bufferBytes;
+
+  if ( device >= NULL_DEVICE_COUNT ) {
+    errorText_ = "RtApiDummy::probeDeviceOpen: device ID is invalid!";
+    return FAILURE;
+  }
+
+  if ( sampleRate == 0 ) {
+    errorText_ = "RtApiDummy::probeDeviceOpen: sample rate must be non-zero!";
+    return FAILURE;
+  }
+
+  // There is no hardware to negotiate with, so every request is
+  // granted as asked.  A zero buffer size means "pick one for me".
+  if ( *bufferSize == 0 ) *bufferSize = 256;
+  stream_.bufferSize = *bufferSize;
+  stream_.nBuffers = 1;
+  stream_.sampleRate = sampleRate;
+  stream_.userFormat = format;
+  stream_.deviceFormat[mode] = format;
+  stream_.nUserChannels[mode] = channels;
+  stream_.nDeviceChannels[mode] = channels + firstChannel;
+  stream_.latency[mode] = *bufferSize;
+
+  // Set interleaving parameters.
+  stream_.userInterleaved = true;
+  stream_.deviceInterleaved[mode] = true;
+  if ( options && options->flags & RTAUDIO_NONINTERLEAVED )
+    stream_.userInterleaved = false;
+
+  // Set flags for buffer conversion
+  stream_.doConvertBuffer[mode] = false;
+  if ( stream_.nUserChannels[mode] < stream_.nDeviceChannels[mode] )
+    stream_.doConvertBuffer[mode] = true;
+  if ( stream_.userInterleaved != stream_.deviceInterleaved[mode] &&
+       stream_.nUserChannels[mode] > 1 )
+    stream_.doConvertBuffer[mode] = true;
+
+  // Allocate the stream handle if necessary and then save.
+  if ( stream_.apiHandle == 0 ) {
+    try {
+      handle = new DummyHandle;
+    }
+    catch ( std::bad_alloc& ) {
+      errorText_ = "RtApiDummy::probeDeviceOpen: error allocating DummyHandle memory.";
+      goto error;
+    }
+    stream_.apiHandle = (void *) handle;
+  }
+  else {
+    handle = (DummyHandle *) stream_.apiHandle;
+  }
+
+  if ( mode == OUTPUT && device == NULL_FILE_DEVICE ) {
+    std::string filename = "rtaudio_null.wav";
+    if ( options && !options->streamName.empty() ) filename = options->streamName;
+    std::string extension = filename.size() >= 4 ? filename.substr( filename.size() - 4 ) : "";
+    for ( unsigned int i=0; i<extension.size(); i++ )
+      extension[i] = (char) tolower( extension[i] );
+    handle->isWav = ( extension == ".wav" );
+    handle->file = fopen( filename.c_str(), "wb" );
+    if ( handle->file == NULL ) {
+      errorStream_ << "RtApiDummy::probeDeviceOpen: error opening output file (" << filename << ").";
+      errorText_ = errorStream_.str();
+      goto error;
+    }
+    if ( handle->isWav )
+      writeWavHeader( handle->file, format, stream_.nDeviceChannels[0], sampleRate,
+                      formatBytes( format ), 0 );
+  }
+
+  // Allocate necessary internal buffers.
+  bufferBytes = stream_.nUserChannels[mode] * *bufferSize * formatBytes( stream_.userFormat );
+  stream_.userBuffer[mode] = (char *) calloc( bufferBytes, 1 );
+  if ( stream_.userBuffer[mode] == NULL ) {
+    errorText_ = "RtApiDummy::probeDeviceOpen: error allocating user buffer memory.";
+    goto error;
+  }
+
+  if ( stream_.doConvertBuffer[mode] ) {
+
+    bool makeBuffer = true;
+    bufferBytes = stream_.nDeviceChannels[mode] * formatBytes( stream_.deviceFormat[mode] );
+    if ( mode == INPUT ) {
+      if ( stream_.mode == OUTPUT && stream_.deviceBuffer ) {
+        unsigned long bytesOut = stream_.nDeviceChannels[0] * formatBytes( stream_.deviceFormat[0] );
+        if ( bufferBytes <= bytesOut ) makeBuffer = false;
+      }
+    }
+
+    if ( makeBuffer ) {
+      bufferBytes *= *bufferSize;
+      if ( stream_.deviceBuffer ) free( stream_.deviceBuffer );
+      stream_.deviceBuffer = (char *) calloc( bufferBytes, 1 );
+      if ( stream_.deviceBuffer == NULL ) {
+        errorText_ = "RtApiDummy::probeDeviceOpen: error allocating device buffer memory.";
+        goto error;
+      }
+    }
+  }
+
+  stream_.device[mode] = device;
+  stream_.state = STREAM_STOPPED;
+
+  // Setup the buffer conversion information structure.
+  if ( stream_.doConvertBuffer[mode] ) setConvertInfo( mode, firstChannel );
+
+  // Setup thread if necessary.
+  if ( stream_.mode == OUTPUT && mode == INPUT ) {
+    // We had already set up an output stream, which decides the pacing.
+    stream_.mode = DUPLEX;
+  }
+  else {
+    stream_.mode = mode;
+    handle->freeRunning = ( device == NULL_FILE_DEVICE );
+
+    // Setup callback thread.
+    stream_.callbackInfo.object = (void *) this;
+    stream_.callbackInfo.isRunning = true;
+    try {
+      handle->thread = std::thread( dummyCallbackHandler, &stream_.callbackInfo );
+    }
+    catch ( std::system_error& ) {
+      stream_.callbackInfo.isRunning = false;
+      errorText_ = "RtApiDummy::error creating callback thread!";
+      goto error;
+    }
+  }
+
+  return SUCCESS;
+
+ error:
+  if ( handle ) {
+    if ( handle->file ) fclose( handle->file );
+    delete handle;
+    stream_.apiHandle = 0;
+  }
+
+  for ( int i=0; i<2; i++ ) {
+    if ( stream_.userBuffer[i] ) {
+      free( stream_.userBuffer[i] );
+      stream_.userBuffer[i] = 0;
+    }
+  }
+
+  if ( stream_.deviceBuffer ) {
+    free( stream_.deviceBuffer );
+    stream_.deviceBuffer = 0;
+  }
+
+  return FAILURE;
+}
+
+void RtApiDummy :: closeStream()
+{
+  if ( stream_.state == STREAM_CLOSED ) {
+    errorText_ = "RtApiDummy::closeStream(): no open stream to close!";
+    error( RtAudioError::WARNING );
+    return;
+  }
+
+  DummyHandle *handle = (DummyHandle *) stream_.apiHandle;
+  if ( handle ) {
+    {
+      std::lock_guard<std::mutex> lock( handle->mutex );
+      stream_.callbackInfo.isRunning = false;
+      stream_.state = STREAM_STOPPED;
+    }
+    handle->runnable.notify_one();
+    if ( handle->thread.joinable() ) handle->thread.join();
+
+    if ( handle->file ) {
+      if ( handle->isWav ) {
+        // Patch the chunk sizes now that the data length is known.
+        fseek( handle->file, 0, SEEK_SET );
+        writeWavHeader( handle->file, stream_.deviceFormat[0], stream_.nDeviceChannels[0],
+                        stream_.sampleRate, formatBytes( stream_.deviceFormat[0] ),
+                        handle->dataBytes );
+      }
+      fclose( handle->file );
+    }
+    delete handle;
+    stream_.apiHandle = 0;
+  }
+
+  for ( int i=0; i<2; i++ ) {
+    if ( stream_.userBuffer[i] ) {
+      free( stream_.userBuffer[i] );
+      stream_.userBuffer[i] = 0;
+    }
+  }
+
+  if ( stream_.deviceBuffer ) {
+    free( stream_.deviceBuffer );
+    stream_.deviceBuffer = 0;
+  }
+
+  stream_.mode = UNINITIALIZED;
+  stream_.state = STREAM_CLOSED;
+}
+
+void RtApiDummy :: startStream()
+{
+  verifyStream();
+  if ( stream_.state == STREAM_RUNNING ) {
+    errorText_ = "RtApiDummy::startStream(): the stream is already running!";
+    error( RtAudioError::WARNING );
+    return;
+  }
+
+  DummyHandle *handle = (DummyHandle *) stream_.apiHandle;
+  {
+    std::lock_guard<std::mutex> lock( handle->mutex );
+    handle->startTime = std::chrono::steady_clock::now();
+    handle->framesSinceStart = 0;
+    stream_.state = STREAM_RUNNING;
+  }
+  handle->runnable.notify_one();
+}
+
+void RtApiDummy :: stopStream()
+{
+  verifyStream();
+  if ( stream_.state == STREAM_STOPPED ) {
+    errorText_ = "RtApiDummy::stopStream(): the stream is already stopped!";
+    error( RtAudioError::WARNING );
+    return;
+  }
+
+  // Nothing is queued anywhere, so stopping never has to drain.
+  DummyHandle *handle = (DummyHandle *) stream_.apiHandle;
+  std::lock_guard<std::mutex> lock( handle->mutex );
+  stream_.state = STREAM_STOPPED;
+}
+
+void RtApiDummy :: abortStream()
+{
+  verifyStream();
+  if ( stream_.state == STREAM_STOPPED ) {
+    errorText_ = "RtApiDummy::abortStream(): the stream is already stopped!";
+    error( RtAudioError::WARNING );
+    return;
+  }
+
+  DummyHandle *handle = (DummyHandle *) stream_.apiHandle;
+  std::lock_guard<std::mutex> lock( handle->mutex );
+  stream_.state = STREAM_STOPPED;
+}
+
+void RtApiDummy :: callbackEvent()
+{
+  DummyHandle *handle = (DummyHandle *) stream_.apiHandle;
+  {
+    std::unique_lock<std::mutex> lock( handle->mutex );
+    while ( stream_.state != STREAM_RUNNING && stream_.callbackInfo.isRunning )
+      handle->runnable.wait( lock );
+    if ( stream_.callbackInfo.isRunning == false ) return;
+  }
+
+  // The null device only ever records silence.
+  if ( stream_.mode == INPUT || stream_.mode == DUPLEX )
+    memset( stream_.userBuffer[1], 0,
+            stream_.bufferSize * stream_.nUserChannels[1] * formatBytes( stream_.userFormat ) );
+
+  // Invoke user callback to get fresh output data.
+  int doStopStream = 0;
+  RtAudioCallback callback = (RtAudioCallback) stream_.callbackInfo.callback;
+  double streamTime = getStreamTime();
+  RtAudioStreamStatus status = 0;
+  if ( handle->xrun == true ) {
+    status |= RTAUDIO_OUTPUT_UNDERFLOW;
+    handle->xrun = false;
+  }
+  doStopStream = callback( stream_.userBuffer[0], stream_.userBuffer[1],
+                           stream_.bufferSize, streamTime, status, stream_.callbackInfo.userData );
+  if ( doStopStream == 2 ) {
+    this->abortStream();
+    return;
+  }
+
+  bool writeFailed = false;
+  {
+    std::lock_guard<std::mutex> lock( handle->mutex );
+
+    // The state might change while waiting on the mutex.
+    if ( stream_.state == STREAM_RUNNING && handle->file &&
+         ( stream_.mode == OUTPUT || stream_.mode == DUPLEX ) ) {
+      char *buffer = stream_.userBuffer[0];
+      unsigned long bytes = stream_.bufferSize * stream_.nUserChannels[0] * formatBytes( stream_.userFormat );
+      if ( stream_.doConvertBuffer[0] ) {
+        buffer = stream_.deviceBuffer;
+        convertBuffer( buffer, stream_.userBuffer[0], stream_.convertInfo[0] );
+        bytes = stream_.bufferSize * stream_.nDeviceChannels[0] * formatBytes( stream_.deviceFormat[0] );
+      }
+
+      if ( fwrite( buffer, 1, bytes, handle->file ) == bytes )
+        handle->dataBytes += bytes;
+      else
+        writeFailed = true;
+    }
+  }
+
+  if ( writeFailed ) {
+    errorText_ = "RtApiDummy::callbackEvent: audio file write error.";
+    error( RtAudioError::WARNING );
+  }
+
+  RtApi::tickStreamTime();
+
+  if ( handle->freeRunning == false ) {
+    // Sleep until the wall-clock time at which a sound card would have
+    // consumed this buffer.  If the callback overran that deadline,
+    // report an underflow and restart the clock instead of bursting.
+    handle->framesSinceStart += stream_.bufferSize;
+    std::chrono::steady_clock::time_point deadline = handle->startTime +
+      std::chrono::duration_cast<std::chrono::steady_clock::duration>
+      ( std::chrono::duration<double>( handle->framesSinceStart / (double) stream_.sampleRate ) );
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if ( deadline < now ) {
+      handle->xrun = true;
+      handle->startTime = now;
+      handle->framesSinceStart = 0;
+    }
+    else
+      std::this_thread::sleep_until( deadline );
+  }
+
+  if ( doStopStream == 1 ) this->stopStream();
+}
+
+static void dummyCallbackHandler( CallbackInfo *info )
+{
+  RtApiDummy *object = (RtApiDummy *) info->object;
+  bool *isRunning = &info->isRunning;
+
+  while ( *isRunning == true ) {
+    object->callbackEvent();
+  }
+}
+
+//******************** End of __RTAUDIO_DUMMY__ *********************//
+#endif
+
+
 // *************************************************** //
 //
 // Protected common (OS-independent) RtAudio methods.
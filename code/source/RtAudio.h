@@ -276,7 +276,7 @@ class RtAudio
     WINDOWS_WASAPI, /*!< The Microsoft WASAPI API. */
     WINDOWS_ASIO,   /*!< The Steinberg Audio Stream I/O API. */
     WINDOWS_DS,     /*!< The Microsoft Direct Sound API. */
-    RTAUDIO_DUMMY   /*!< A compilable but non-functional API. */
+    RTAUDIO_DUMMY   /*!< A null API with a clock-paced device and a file-writing device. */
   };
 
   //! The public device information structure for returning queried values.
@@ -602,6 +602,13 @@ class RtAudio
 
 #endif
 
+// The null (dummy) API is always compiled in, after any real APIs, so
+// that a stream can still be opened on machines without a sound card.
+// Define __RTAUDIO_NO_NULL_DEVICE__ to get the old behavior back.
+#if !defined(__RTAUDIO_DUMMY__) && !defined(__RTAUDIO_NO_NULL_DEVICE__)
+  #define __RTAUDIO_DUMMY__
+#endif
+
 // This global structure type is used to pass callback information
 // between the private RtAudio stream structure and global callback
 // handling functions.
@@ -1134,21 +1141,42 @@ class RtApiDummy: public RtApi
 {
 public:
 
-  RtApiDummy() { errorText_ = "RtApiDummy: This class provides no functionality."; error( RtAudioError::WARNING ); }
+  //! Device ids exposed by the null API.
+  /*!
+    NULL_CLOCK_DEVICE calls back once per buffer period of wall-clock
+    time, like a real sound card would.  NULL_FILE_DEVICE calls back as
+    fast as possible and appends each output buffer to the file named by
+    RtAudio::StreamOptions::streamName ("rtaudio_null.wav" if empty).  A
+    name ending in ".wav" gets a RIFF/WAVE header, anything else is
+    written as raw interleaved samples in native byte order.  Input
+    channels on either device always read silence.
+  */
+  enum { NULL_CLOCK_DEVICE = 0, NULL_FILE_DEVICE = 1, NULL_DEVICE_COUNT = 2 };
+
+  RtApiDummy();
+  ~RtApiDummy();
   RtAudio::Api getCurrentApi( void ) { return RtAudio::RTAUDIO_DUMMY; }
-  unsigned int getDeviceCount( void ) { return 0; }
-  RtAudio::DeviceInfo getDeviceInfo( unsigned int /*device*/ ) { RtAudio::DeviceInfo info; return info; }
-  void closeStream( void ) {}
-  void startStream( void ) {}
-  void stopStream( void ) {}
-  void abortStream( void ) {}
+  unsigned int getDeviceCount( void ) { return NULL_DEVICE_COUNT; }
+  RtAudio::DeviceInfo getDeviceInfo( unsigned int device );
+  unsigned int getDefaultOutputDevice( void ) { return NULL_CLOCK_DEVICE; }
+  unsigned int getDefaultInputDevice( void ) { return NULL_CLOCK_DEVICE; }
+  void closeStream( void );
+  void startStream( void );
+  void stopStream( void );
+  void abortStream( void );
+
+  // This function is intended for internal use only.  It must be
+  // public because it is called by the internal callback handler,
+  // which is not a member of RtAudio.  External use of this function
+  // will most likely produce highly undesireable results!
+  void callbackEvent( void );
 
   private:
 
-  bool probeDeviceOpen( unsigned int /*device*/, StreamMode /*mode*/, unsigned int /*channels*/, 
-                        unsigned int /*firstChannel*/, unsigned int /*sampleRate*/,
-                        RtAudioFormat /*format*/, unsigned int * /*bufferSize*/,
-                        RtAudio::StreamOptions * /*options*/ ) { return false; }
+  bool probeDeviceOpen( unsigned int device, StreamMode mode, unsigned int channels, 
+                        unsigned int firstChannel, unsigned int sampleRate,
+                        RtAudioFormat format, unsigned int *bufferSize,
+                        RtAudio::StreamOptions *options );
 };
 
 #endif
@@ -0,0 +1,149 @@
+#ifndef SmallBoard_h
+#define SmallBoard_h
+#include <G3D/G3DAll.h>
+#include "PlayHead.h"
+
+/**
+    Lookup tables and bitboards for stepping a board of at most SIZE x SIZE
+    cells, which covers the boards sets are played on.
+
+    Cell (x, y) is y * SIZE + x, so a position packs and unpacks with a
+    shift and a mask. Where each head moves and which cells are at an edge
+    are tabulated once per board size and topology, using the topology's
+    own move() and edge() so the results match the general step exactly.
+    A step then moves a head with one table read, finds cells holding more
+    than one head with a few bitwise operations on the occupancy bitboards,
+    and only calls the topology for the rare head at an edge.
+
+    SIZE is 8, which fits a board in one 64-bit word, or 16.
+
+    Simulation thread only.
+ */
+template<int SIZE>
+class SmallBoard {
+public:
+    static_assert((SIZE == 8) || (SIZE == 16), "SmallBoard supports 8x8 and 16x16");
+
+    static const int SHIFT = (SIZE == 8) ? 3 : 4;
+    static const int CELLS = SIZE * SIZE;
+    static const int WORDS = (CELLS + 63) / 64;
+
+    /** One bit per cell */
+    struct Bits {
+        uint64 word[WORDS];
+
+        void clear() {
+            for (int i = 0; i < WORDS; ++i) {
+                word[i] = 0;
+            }
+        }
+
+        bool test(int cell) const {
+            return ((word[cell >> 6] >> (cell & 63)) & 1) != 0;
+        }
+
+        void set(int cell) {
+            word[cell >> 6] |= uint64(1) << (cell & 63);
+        }
+
+        bool any() const {
+            uint64 all = 0;
+            for (int i = 0; i < WORDS; ++i) {
+                all |= word[i];
+            }
+            return all != 0;
+        }
+    };
+
+    /** Cell for each direction and cell a head moving that way from it arrives in */
+    uint8   next[Direction::DOWN_RIGHT + 1][CELLS];
+
+    /** The cell a head in each cell collides in: itself, except on the seam
+        of a wrapping board, which has two names */
+    uint8   occupancy[CELLS];
+
+    /** Per direction, the cells where a head facing it is at an edge */
+    Bits    edge[Direction::DOWN_RIGHT + 1];
+
+    /** Occupancy cells holding at least one head, and at least two */
+    Bits    once;
+    Bits    twice;
+
+    /** Per occupancy cell, the lowest-numbered head in it, while collisions
+        are found. All -1 between steps */
+    int     first[CELLS];
+
+private:
+
+    /** What the tables were built for */
+    int             m_edges;
+    int             m_width;
+    int             m_height;
+
+public:
+
+    SmallBoard() : m_edges(-1), m_width(0), m_height(0) {
+        for (int c = 0; c < CELLS; ++c) {
+            first[c] = -1;
+        }
+    }
+
+    static bool fits(int width, int height) {
+        return (width <= SIZE) && (height <= SIZE);
+    }
+
+    static int cell(const Vector2int16& p) {
+        return (p.y << SHIFT) | p.x;
+    }
+
+    static Vector2int16 position(int cell) {
+        return Vector2int16(cell & (SIZE - 1), cell >> SHIFT);
+    }
+
+    /** Records a head in occupancy cell \a c, and whether it is not the first */
+    void occupy(int c) {
+        const int      w   = c >> 6;
+        const uint64   bit = uint64(1) << (c & 63);
+        twice.word[w] |= once.word[w] & bit;
+        once.word[w]  |= bit;
+    }
+
+    /** Rebuilds the tables unless they are already for a \a width x \a
+        height board with \a edges, which names Topology's edge policy. The
+        tables do not depend on its lattice */
+    template<class Topology>
+    void prepare(int width, int height, int edges) {
+        if ((m_edges == edges) && (m_width == width) && (m_height == height)) {
+            return;
+        }
+        m_edges    = edges;
+        m_width    = width;
+        m_height   = height;
+
+        for (int d = 0; d <= Direction::DOWN_RIGHT; ++d) {
+            edge[d].clear();
+        }
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                const int c = cell(Vector2int16(x, y));
+                // Same cell index for the same cell, whichever name it has
+                const int o = Topology::cell(Vector2int16(x, y), width, height);
+                occupancy[c] = uint8(cell(Vector2int16(o % width, o / width)));
+                for (int d = 0; d <= Direction::DOWN_RIGHT; ++d) {
+                    PlayHead head(x, y, Direction(d));
+                    Topology::move(head, width, height);
+                    next[d][c] = uint8(cell(head.position));
+
+                    PlayHead atEdge(x, y, Direction(d));
+                    Vector2int16 hit;
+                    Direction wall;
+                    if (Topology::edge(atEdge, width, height, hit, wall)) {
+                        edge[d].set(c);
+                    }
+                }
+            }
+        }
+    }
+};
+
+#endif
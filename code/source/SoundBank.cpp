@@ -0,0 +1,250 @@
+#include "SoundBank.h"
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+/** Below this many total samples to render, a bank stays on the calling thread */
+static const int PARALLEL_SAMPLE_THRESHOLD = 1 << 18;
+
+static const char*  CACHE_FILE_MAGIC   = "SBNK";
+static const int32  CACHE_FILE_VERSION = 2;
+
+/** Everything that determines a rendered note's contents */
+struct NoteKey {
+    SoundBank::Waveform waveform;
+    double  frequency;
+    int     sampleCountDuration;
+    float   fadeOutProportion;
+    int     sampleRate;
+
+    NoteKey() {}
+    NoteKey(SoundBank::Waveform w, double f, int count, float fade, int rate) :
+        waveform(w), frequency(f), sampleCountDuration(count), fadeOutProportion(fade), sampleRate(rate) {}
+
+    bool operator==(const NoteKey& other) const {
+        return (waveform == other.waveform) && (frequency == other.frequency) &&
+            (sampleCountDuration == other.sampleCountDuration) &&
+            (fadeOutProportion == other.fadeOutProportion) && (sampleRate == other.sampleRate);
+    }
+
+    size_t hashCode() const {
+        size_t h = std::hash<double>()(frequency);
+        h = h * 31 + std::hash<float>()(fadeOutProportion);
+        h = h * 31 + size_t(sampleCountDuration);
+        h = h * 31 + size_t(sampleRate);
+        return h * 31 + size_t(int(waveform));
+    }
+};
+
+struct NoteCache {
+    struct Entry {
+        shared_ptr<AudioSample> sample;
+        /** Value of NoteCache::clock when last returned */
+        uint64 lastUse;
+    };
+
+    std::mutex          mutex;
+    Table<NoteKey, Entry> table;
+    uint64              clock;
+    size_t              bytes;
+    size_t              budget;
+
+    NoteCache() : clock(0), bytes(0), budget(64 * 1024 * 1024) {}
+
+    /** Returns null on a miss. Call with mutex held */
+    shared_ptr<AudioSample> find(const NoteKey& key) {
+        Entry* e = table.getPointer(key);
+        if (isNull(e)) {
+            return shared_ptr<AudioSample>();
+        }
+        e->lastUse = ++clock;
+        return e->sample;
+    }
+
+    /** Returns the cached sample if another thread inserted \a key first. Call with mutex held */
+    shared_ptr<AudioSample> insert(const NoteKey& key, const shared_ptr<AudioSample>& sample) {
+        const shared_ptr<AudioSample>& existing = find(key);
+        if (notNull(existing)) {
+            return existing;
+        }
+        Entry& e  = table[key];
+        e.sample  = sample;
+        e.lastUse = ++clock;
+        bytes    += sample->buffer.size() * sizeof(Sample);
+        evict();
+        return sample;
+    }
+
+    /** Drops least recently used notes until within budget. Call with mutex held */
+    void evict() {
+        if (bytes <= budget) {
+            return;
+        }
+        Array<NoteKey> keys;
+        table.getKeys(keys);
+        Array<uint64> lastUses;
+        for (const NoteKey& k : keys) {
+            lastUses.append(table[k].lastUse);
+        }
+        while ((bytes > budget) && (keys.size() > 0)) {
+            int oldest = 0;
+            for (int i = 1; i < keys.size(); ++i) {
+                if (lastUses[i] < lastUses[oldest]) {
+                    oldest = i;
+                }
+            }
+            bytes -= table[keys[oldest]].sample->buffer.size() * sizeof(Sample);
+            table.remove(keys[oldest]);
+            keys.fastRemove(oldest);
+            lastUses.fastRemove(oldest);
+        }
+    }
+};
+
+static NoteCache& noteCache() {
+    static NoteCache cache;
+    return cache;
+}
+
+shared_ptr<AudioSample> SoundBank::createSine(int sampleRate, double frequency, int sampleCountDuration, float fadeOutProportion) {
+    const NoteKey key(Waveform::SINE, frequency, sampleCountDuration, fadeOutProportion, sampleRate);
+    NoteCache& cache = noteCache();
+    {
+        std::lock_guard<std::mutex> lock(cache.mutex);
+        const shared_ptr<AudioSample>& s = cache.find(key);
+        if (notNull(s)) {
+            return s;
+        }
+    }
+    // Render outside the lock so other threads can keep hitting the cache
+    const shared_ptr<AudioSample>& s = AudioSample::createSine(sampleRate, frequency, sampleCountDuration, fadeOutProportion);
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    return cache.insert(key, s);
+}
+
+Array<shared_ptr<AudioSample>> SoundBank::createSines(int sampleRate, const Array<double>& frequencies, int sampleCountDuration, float fadeOutProportion) {
+    Array<shared_ptr<AudioSample>> bank;
+    bank.resize(frequencies.size());
+
+    Array<int> missing;
+    NoteCache& cache = noteCache();
+    {
+        std::lock_guard<std::mutex> lock(cache.mutex);
+        for (int i = 0; i < frequencies.size(); ++i) {
+            bank[i] = cache.find(NoteKey(Waveform::SINE, frequencies[i], sampleCountDuration, fadeOutProportion, sampleRate));
+            if (isNull(bank[i])) {
+                missing.append(i);
+            }
+        }
+    }
+
+    const int numThreads = min(int(std::thread::hardware_concurrency()), missing.size());
+    if ((numThreads <= 1) || (missing.size() * sampleCountDuration < PARALLEL_SAMPLE_THRESHOLD)) {
+        for (int i : missing) {
+            bank[i] = createSine(sampleRate, frequencies[i], sampleCountDuration, fadeOutProportion);
+        }
+        return bank;
+    }
+
+    // Workers pull notes from a shared counter, so uneven note costs still balance
+    std::atomic<int> next(0);
+    // std::vector because G3D::Array copies its elements and threads are move-only
+    std::vector<std::thread> workers;
+    for (int t = 0; t < numThreads; ++t) {
+        workers.push_back(std::thread([&]() {
+            for (int m = next++; m < missing.size(); m = next++) {
+                const int i = missing[m];
+                bank[i] = createSine(sampleRate, frequencies[i], sampleCountDuration, fadeOutProportion);
+            }
+        }));
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    return bank;
+}
+
+void SoundBank::setCacheBudget(size_t bytes) {
+    NoteCache& cache = noteCache();
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    cache.budget = bytes;
+    cache.evict();
+}
+
+void SoundBank::clearCache() {
+    NoteCache& cache = noteCache();
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    cache.table.clear();
+    cache.bytes = 0;
+}
+
+size_t SoundBank::cacheSize() {
+    NoteCache& cache = noteCache();
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    return cache.bytes;
+}
+
+bool SoundBank::loadCache(const String& filename) {
+    if (! FileSystem::exists(filename)) {
+        return false;
+    }
+    BinaryInput b(filename, G3D_LITTLE_ENDIAN);
+    char magic[4];
+    if (b.getLength() < 12) {
+        return false;
+    }
+    b.readBytes(magic, 4);
+    if ((memcmp(magic, CACHE_FILE_MAGIC, 4) != 0) || (b.readInt32() != CACHE_FILE_VERSION)) {
+        return false;
+    }
+
+    const int count = b.readInt32();
+    for (int i = 0; i < count; ++i) {
+        NoteKey key;
+        key.waveform            = Waveform(b.readInt32());
+        key.frequency           = b.readFloat64();
+        key.sampleCountDuration = b.readInt32();
+        key.fadeOutProportion   = b.readFloat32();
+        key.sampleRate          = b.readInt32();
+        const int sampleCount   = b.readInt32();
+        if ((sampleCount < 0) || (b.getPosition() + int64(sampleCount) * int64(sizeof(Sample)) > b.getLength())) {
+            // Truncated file; keep what was read so far
+            return false;
+        }
+
+        shared_ptr<AudioSample> s(new AudioSample());
+        s->sampleRate = key.sampleRate;
+        s->buffer.resize(sampleCount);
+        b.readBytes(s->buffer.getCArray(), int64(sampleCount) * sizeof(Sample));
+
+        NoteCache& cache = noteCache();
+        std::lock_guard<std::mutex> lock(cache.mutex);
+        cache.insert(key, s);
+    }
+    return true;
+}
+
+void SoundBank::saveCache(const String& filename) {
+    NoteCache& cache = noteCache();
+    std::lock_guard<std::mutex> lock(cache.mutex);
+
+    Array<NoteKey> keys;
+    cache.table.getKeys(keys);
+
+    BinaryOutput b(filename, G3D_LITTLE_ENDIAN);
+    b.writeBytes(CACHE_FILE_MAGIC, 4);
+    b.writeInt32(CACHE_FILE_VERSION);
+    b.writeInt32(keys.size());
+    for (const NoteKey& key : keys) {
+        const shared_ptr<AudioSample>& s = cache.table[key].sample;
+        b.writeInt32(int(key.waveform));
+        b.writeFloat64(key.frequency);
+        b.writeInt32(key.sampleCountDuration);
+        b.writeFloat32(key.fadeOutProportion);
+        b.writeInt32(key.sampleRate);
+        b.writeInt32(s->sampleCount());
+        b.writeBytes(s->buffer.getCArray(), int64(s->sampleCount()) * sizeof(Sample));
+    }
+    b.commit();
+}
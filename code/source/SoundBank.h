@@ -0,0 +1,50 @@
+#ifndef SoundBank_h
+#define SoundBank_h
+#include <G3D/G3DAll.h>
+#include "AudioSample.h"
+
+/** 
+    Builds banks of pre-rendered notes.
+
+    Every rendered note goes into a process-wide cache keyed by everything
+    that determines its contents (waveform, frequency, length, fade and sample
+    rate), so reloading a grid or switching back to an earlier scale reuses the
+    existing buffers instead of rendering them again. The returned samples are
+    shared: callers must never modify them. Evicting an entry only drops the
+    cache's reference, so voices still playing it keep it alive.
+
+    The cache can be saved to and restored from disk to also skip rendering
+    on the next launch.
+ */
+class SoundBank {
+public:
+    G3D_DECLARE_ENUM_CLASS(Waveform, SINE);
+
+    /** Cached AudioSample::createSine */
+    static shared_ptr<AudioSample> createSine(int sampleRate, double frequency, int sampleCountDuration, float fadeOutProportion);
+
+    /** 
+      One createSine per frequency, in the same order. Notes missing from the
+      cache are rendered in parallel across all cores when there are enough of
+      them; small banks stay on the calling thread, where spawning workers
+      would cost more than it saves.
+     */
+    static Array<shared_ptr<AudioSample>> createSines(int sampleRate, const Array<double>& frequencies, int sampleCountDuration, float fadeOutProportion);
+
+    /** Least recently used notes are dropped once the cache holds more than
+        this many bytes of sample data. Default is 64 MB */
+    static void setCacheBudget(size_t bytes);
+
+    static void clearCache();
+
+    /** Bytes of sample data currently held by the cache */
+    static size_t cacheSize();
+
+    /** Adds the notes stored in \a filename to the cache. Returns false if the
+        file is missing or not a sound bank cache of this version */
+    static bool loadCache(const String& filename);
+
+    /** Writes every cached note to \a filename */
+    static void saveCache(const String& filename);
+};
+#endif
@@ -0,0 +1,106 @@
+#include "SpectrumAnalyzer.h"
+
+static const int   DEFAULT_FRAME_SIZE = 2048;
+static const float DEFAULT_OVERLAP    = 0.5f;
+
+/** capture() publishes at least this often, which bounds how far ahead of
+    the published write index it can be overwriting */
+static const int CAPTURE_BLOCK = 1024;
+
+/** Magnitudes are clamped here so silence gives a finite reading */
+static const float SILENCE_DB = -120.0f;
+
+SpectrumAnalyzer::SpectrumAnalyzer() : m_writeIndex(0), m_frameSize(0), m_hopSize(0), m_nextFrameEnd(0), m_frameCount(0) {
+    m_ring.resize(RING_SIZE);
+    System::memset(m_ring.getCArray(), 0, sizeof(Sample) * RING_SIZE);
+    configure(DEFAULT_FRAME_SIZE, DEFAULT_OVERLAP);
+}
+
+void SpectrumAnalyzer::configure(int frameSize, float overlap) {
+    alwaysAssertM(isPow2(frameSize) && (frameSize >= 4) && (frameSize <= RING_SIZE / 2),
+        "Spectrum frame size must be a power of two no larger than half the capture ring");
+    m_frameSize = frameSize;
+    m_hopSize   = max(1, int(frameSize * (1.0f - clamp(overlap, 0.0f, 0.99f))));
+
+    // Hann window
+    m_window.resize(frameSize);
+    for (int i = 0; i < frameSize; ++i) {
+        m_window[i] = 0.5f - 0.5f * cosf(2.0f * pif() * float(i) / float(frameSize));
+    }
+
+    m_fft.reset(new FFT(frameSize));
+
+    m_re.resize(frameSize);
+    m_im.resize(frameSize);
+    m_waveform.resize(frameSize);
+    System::memset(m_waveform.getCArray(), 0, sizeof(Sample) * frameSize);
+    m_spectrum.resize(frameSize / 2 + 1);
+    for (float& s : m_spectrum) {
+        s = SILENCE_DB;
+    }
+    m_nextFrameEnd = m_writeIndex.load(std::memory_order_acquire) + uint32(m_hopSize);
+}
+
+void SpectrumAnalyzer::capture(const Sample* interleaved, int frameCount, int channelCount) {
+    uint32 write = m_writeIndex.load(std::memory_order_relaxed);
+    Sample* ring = m_ring.getCArray();
+    const float scale = 1.0f / float(channelCount);
+    for (int block = 0; block < frameCount; block += CAPTURE_BLOCK) {
+        const int end = min(block + CAPTURE_BLOCK, frameCount);
+        for (int f = block; f < end; ++f) {
+            const Sample* frame = interleaved + f * channelCount;
+            Sample sum = frame[0];
+            for (int c = 1; c < channelCount; ++c) {
+                sum += frame[c];
+            }
+            ring[write & (RING_SIZE - 1)] = sum * scale;
+            ++write;
+        }
+        m_writeIndex.store(write, std::memory_order_release);
+    }
+}
+
+bool SpectrumAnalyzer::update() {
+    const uint32 write = m_writeIndex.load(std::memory_order_acquire);
+    if (int32(write - m_nextFrameEnd) < 0) {
+        return false;
+    }
+    // Visuals only need the latest frame, so skip any the reader fell behind on
+    const uint32 behind   = write - m_nextFrameEnd;
+    const uint32 frameEnd = m_nextFrameEnd + (behind / uint32(m_hopSize)) * uint32(m_hopSize);
+    m_nextFrameEnd = frameEnd + uint32(m_hopSize);
+
+    const uint32 frameStart = frameEnd - uint32(m_frameSize);
+    const Sample* ring = m_ring.getCArray();
+    for (int i = 0; i < m_frameSize; ++i) {
+        m_waveform[i] = ring[(frameStart + uint32(i)) & (RING_SIZE - 1)];
+    }
+    // If capture() wrapped around onto the frame while it was copied, the
+    // copy may be torn. Keep the previous spectrum instead. capture() may be
+    // up to CAPTURE_BLOCK samples past what it has published
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (m_writeIndex.load(std::memory_order_relaxed) - frameStart > uint32(RING_SIZE - CAPTURE_BLOCK)) {
+        return false;
+    }
+
+    analyze();
+    return true;
+}
+
+void SpectrumAnalyzer::analyze() {
+    const int n = m_frameSize;
+    for (int i = 0; i < n; ++i) {
+        m_re[i] = m_waveform[i] * m_window[i];
+        m_im[i] = 0.0f;
+    }
+    m_fft->forward(m_re.getCArray(), m_im.getCArray());
+
+    // The Hann window halves the amplitude; a real sine splits between the
+    // positive and negative frequency bins
+    const float scale = 2.0f / (0.5f * float(n));
+    for (int k = 0; k <= n / 2; ++k) {
+        const float magnitude = sqrtf(m_re[k] * m_re[k] + m_im[k] * m_im[k]) * scale;
+        m_spectrum[k] = max(20.0f * log10f(max(magnitude, 1e-9f)), SILENCE_DB);
+    }
+    ++m_frameCount;
+}
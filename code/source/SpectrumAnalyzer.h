@@ -0,0 +1,86 @@
+#ifndef SpectrumAnalyzer_h
+#define SpectrumAnalyzer_h
+#include <G3D/G3DAll.h>
+#include <atomic>
+#include "util.h"
+#include "FFT.h"
+
+/**
+    Spectrum and waveform of the final mix, for visuals.
+
+    The audio thread calls capture(), which only downmixes into a lock-free
+    single-producer ring and publishes the new write position. Everything
+    else happens in update(), on whichever thread draws: it copies the most
+    recent frameSize() samples out of the ring, applies a Hann window and
+    runs an FFT. If the audio
+    thread overwrote the frame during the copy, the frame is dropped and the
+    previous one kept, so the callback never waits for the reader.
+
+    spectrum(), waveform() and frameCount() must be read on the thread that
+    calls update().
+ */
+class SpectrumAnalyzer {
+public:
+    /** Samples kept by the capture ring; the largest frame is half of this */
+    static const int RING_SIZE = 1 << 15;
+
+private:
+    /** Mono downmix of the output, RING_SIZE long */
+    Array<Sample>           m_ring;
+    /** Total samples captured; only ever written by capture() */
+    std::atomic<uint32>     m_writeIndex;
+
+    int             m_frameSize;
+    int             m_hopSize;
+    /** Write index the next frame ends at */
+    uint32          m_nextFrameEnd;
+    int64           m_frameCount;
+
+    Array<float>    m_window;
+    shared_ptr<FFT> m_fft;
+    Array<float>    m_re;
+    Array<float>    m_im;
+
+    Array<float>    m_spectrum;
+    Array<Sample>   m_waveform;
+
+    /** Windows and transforms m_waveform into m_spectrum */
+    void analyze();
+
+public:
+    SpectrumAnalyzer();
+
+    /** \a frameSize is a power of two up to RING_SIZE / 2. Successive frames
+        overlap by \a overlap of their length, in [0, 1). Allocates, and must
+        not run concurrently with update() */
+    void configure(int frameSize, float overlap);
+
+    int frameSize() const {
+        return m_frameSize;
+    }
+
+    /** Audio thread only. Never blocks or allocates */
+    void capture(const Sample* interleaved, int frameCount, int channelCount);
+
+    /** Analyzes the latest frame if at least one hop of new audio has
+        arrived. Returns true if spectrum() changed */
+    bool update();
+
+    /** frameSize() / 2 + 1 magnitudes in dB, from DC to Nyquist; a full-scale
+        sine at a bin's frequency reads 0 */
+    const Array<float>& spectrum() const {
+        return m_spectrum;
+    }
+
+    /** The frameSize() samples the spectrum was computed from, oldest first */
+    const Array<Sample>& waveform() const {
+        return m_waveform;
+    }
+
+    /** Frames analyzed so far, to tell whether spectrum() is new */
+    int64 frameCount() const {
+        return m_frameCount;
+    }
+};
+
+#endif
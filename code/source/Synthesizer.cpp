@@ -2,21 +2,544 @@
 
 shared_ptr<Synthesizer> Synthesizer::global = shared_ptr<Synthesizer>(new Synthesizer());
 
-void Synthesizer::queueSound(shared_ptr<AudioSample> audioSample, int delay) {
+ChannelPan::ChannelPan(float position, int channelCount) : channel(0) {
+    if (channelCount <= 1) {
+        gain[0] = 1.0f;
+        gain[1] = 0.0f;
+        return;
+    }
+    const float s = clamp(position, 0.0f, 1.0f) * float(channelCount - 1);
+    channel = min(int(s), channelCount - 2);
+    const float angle = (s - float(channel)) * 0.5f * pif();
+    gain[0] = cosf(angle);
+    gain[1] = sinf(angle);
+}
+
+/** Below this many playing voices, mixing stays on the audio thread even
+    with a MixerPool, since waking the workers would cost more than it saves */
+static const int PARALLEL_VOICE_THRESHOLD = 64;
+
+/** dst[i] += src[i] */
+static void addSamples(Sample* dst, const Sample* src, int n) {
+    int i = 0;
+#   ifdef SUBSTEP_SSE
+        for (; i + 4 <= n; i += 4) {
+            _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_loadu_ps(src + i)));
+        }
+#   endif
+    for (; i < n; ++i) {
+        dst[i] += src[i];
+    }
+}
+
+/** Adds \a mono into the interleaved \a output according to \a pan */
+static void panMix(Sample* output, const Sample* mono, int frameCount, int channelCount, const ChannelPan& pan) {
+    if (channelCount == 1) {
+        addSamples(output, mono, frameCount);
+        return;
+    }
+
+    int f = 0;
+#   ifdef SUBSTEP_SSE
+        if (channelCount == 2) {
+            // Each 4 mono samples become 8 interleaved left/right samples
+            const __m128 g = _mm_set_ps(pan.gain[1], pan.gain[0], pan.gain[1], pan.gain[0]);
+            for (; f + 4 <= frameCount; f += 4) {
+                const __m128 m = _mm_loadu_ps(mono + f);
+                Sample* out = output + 2 * f;
+                _mm_storeu_ps(out,     _mm_add_ps(_mm_loadu_ps(out),     _mm_mul_ps(_mm_unpacklo_ps(m, m), g)));
+                _mm_storeu_ps(out + 4, _mm_add_ps(_mm_loadu_ps(out + 4), _mm_mul_ps(_mm_unpackhi_ps(m, m), g)));
+            }
+        }
+#   endif
+    // Only two channels are touched however many there are
+    for (int k = 0; k < 2; ++k) {
+        const int c = pan.channel + k;
+        const float g = pan.gain[k];
+        if ((c >= channelCount) || (g == 0.0f)) {
+            continue;
+        }
+        Sample* out = output + c;
+        for (int i = f; i < frameCount; ++i) {
+            out[i * channelCount] += g * mono[i];
+        }
+    }
+}
+
+bool SoundInstance::play(Array<float>& buffer) {
+    int i = 0;
+    if (currentPosition < 0) {
+        // Still waiting out the delay
+        i = min(-currentPosition, buffer.size());
+        currentPosition += i;
+        if (currentPosition < 0) {
+            return false;
+        }
+    }
+
+    const Sample* samples = audioSample->buffer.getCArray();
+    const int sampleCount = audioSample->sampleCount();
+    if (! shaped) {
+        if (isNull(resampler)) {
+            const int count = min(buffer.size() - i, sampleCount - currentPosition);
+            const Sample* src = samples + currentPosition;
+            Sample* dst = buffer.getCArray() + i;
+            for (int j = 0; j < count; ++j) {
+                dst[j] += src[j];
+            }
+            currentPosition += count;
+            return currentPosition >= sampleCount;
+        } else {
+            const int count = resampler->addTo(samples, sampleCount, sourcePosition, buffer.getCArray() + i, buffer.size() - i);
+            currentPosition += count;
+            return sourcePosition >= resampler->endPosition(sampleCount);
+        }
+    }
+
+    Sample block[EnvelopeGenerator::BLOCK_SIZE];
+    while (i < buffer.size()) {
+        int n = min(int(EnvelopeGenerator::BLOCK_SIZE), buffer.size() - i);
+        const Sample* src = block;
+        bool sourceFinished;
+        if (isNull(resampler)) {
+            n = min(n, sampleCount - currentPosition);
+            src = samples + currentPosition;
+            sourceFinished = (currentPosition + n >= sampleCount);
+        } else {
+            System::memset(block, 0, sizeof(block));
+            n = resampler->addTo(samples, sampleCount, sourcePosition, block, n);
+            sourceFinished = (sourcePosition >= resampler->endPosition(sampleCount));
+        }
+        envelope.mix(buffer.getCArray() + i, src, n, 1.0f);
+        currentPosition += n;
+        i += n;
+        if (sourceFinished || envelope.finished()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+ToneInstance::ToneInstance(const Tone& tone, const Envelope& envelope, int sampleRate, int currentPosition, const ChannelPan& pan) :
+        wavetable(tone.wavetable.get()),
+        table(isNull(tone.wavetable) ? NULL : &tone.wavetable->level(tone.wavetable->levelIndex(tone.frequency, sampleRate))),
+        shape(tone.shape),
+        phase(0),
+        phaseIncrement(uint32(tone.frequency / sampleRate * 4294967296.0)),
+        currentPosition(currentPosition),
+        volume(tone.volume),
+        envelope(envelope, sampleRate),
+        pan(pan) {}
+
+bool ToneInstance::play(Array<float>& buffer) {
+    int i = 0;
+    if (currentPosition < 0) {
+        // Still waiting out the delay
+        i = min(-currentPosition, buffer.size());
+        currentPosition += i;
+        if (currentPosition < 0) {
+            return false;
+        }
+    }
+
+    static const int   BLOCK_SIZE = EnvelopeGenerator::BLOCK_SIZE;
+    static const int   FRAC_BITS  = 32 - Wavetable::TABLE_BITS;
+    static const float FRAC_SCALE = 1.0f / float(1u << FRAC_BITS);
+    const float* t = notNull(table) ? table->getCArray() : NULL;
+
+    Sample block[BLOCK_SIZE];
+    while (i < buffer.size()) {
+        const int n = min(BLOCK_SIZE, buffer.size() - i);
+        if (isNull(t)) {
+            Oscillator::render(shape, block, n, phase, phaseIncrement);
+        } else {
+            // Table reads need a gather, so the oscillator itself stays scalar
+            for (int j = 0; j < n; ++j) {
+                const uint32 index = phase >> FRAC_BITS;
+                const float  frac  = float(phase & ((1u << FRAC_BITS) - 1)) * FRAC_SCALE;
+                block[j] = t[index] + (t[index + 1] - t[index]) * frac;
+                phase += phaseIncrement;
+            }
+        }
+        envelope.mix(buffer.getCArray() + i, block, n, volume);
+        currentPosition += n;
+        i += n;
+        if (envelope.finished()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/** Index of the owner of \a p in \a owners, or -1 */
+template<class T>
+static int ownerIndex(const Array<T>& owners, const void* p) {
+    for (int i = 0; i < owners.size(); ++i) {
+        if (owners[i].object.get() == p) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const Resampler* Synthesizer::acquireResampler(int inputRate) {
+    if (inputRate == m_sampleRate) {
+        return NULL;
+    }
+    for (VoiceOwner<Resampler>& r : m_resamplers) {
+        if (r.object->inputRate() == inputRate) {
+            ++r.voices;
+            return r.object.get();
+        }
+    }
+    m_resamplers.append(VoiceOwner<Resampler>(Resampler::create(inputRate, m_sampleRate, m_resampleQuality)));
+    ++m_resamplers.last().voices;
+    return m_resamplers.last().object.get();
+}
+
+void Synthesizer::retireResamplers() {
+    m_retiredResamplers.append(m_resamplers);
+    m_resamplers.fastClear();
+    m_reclaimPending = true;
+}
+
+void Synthesizer::setSampleRate(int sampleRate) {
+    m_mixMutex.lock(); mutex.lock(); {
+        m_sampleRate = sampleRate;
+        retireResamplers();
+        m_delay.setFormat(sampleRate, m_channelCount);
+        m_masterBus.setFormat(sampleRate, m_channelCount);
+    } mutex.unlock(); m_mixMutex.unlock();
+}
+
+void Synthesizer::allocateMixBuffers() {
+    const int participants = mixThreadCount();
+    m_voiceBuffers.resize(participants);
+    m_subMixes.resize(participants);
+    for (int p = 0; p < participants; ++p) {
+        m_voiceBuffers[p].resize(m_maxFrameCount);
+        m_subMixes[p].resize(m_maxFrameCount * m_channelCount);
+    }
+}
+
+void Synthesizer::setMixThreadCount(int threadCount) {
+    shared_ptr<MixerPool> pool = (threadCount > 1) ? MixerPool::create(threadCount) : shared_ptr<MixerPool>();
+    m_mixMutex.lock(); {
+        std::swap(pool, m_mixerPool);
+        allocateMixBuffers();
+    } m_mixMutex.unlock();
+    // The old pool's threads are joined here, outside the lock
+}
+
+void Synthesizer::setBufferFrameCount(int frameCount) {
+    alwaysAssertM(frameCount > 0, "Need at least one frame per buffer");
+    m_mixMutex.lock(); {
+        m_maxFrameCount = frameCount;
+        allocateMixBuffers();
+    } m_mixMutex.unlock();
+}
+
+void Synthesizer::setReverb(const shared_ptr<ConvolutionReverb>& reverb) {
+    shared_ptr<ConvolutionReverb> old = reverb;
+    m_mixMutex.lock(); {
+        std::swap(old, m_reverb);
+    } m_mixMutex.unlock();
+    // The old reverb's buffers are freed here, outside the lock
+}
+
+void Synthesizer::setChannelCount(int channelCount) {
+    alwaysAssertM(channelCount > 0, "Need at least one output channel");
+    m_mixMutex.lock(); mutex.lock(); {
+        m_channelCount = channelCount;
+        allocateMixBuffers();
+        m_delay.setFormat(m_sampleRate, channelCount);
+        m_masterBus.setFormat(m_sampleRate, channelCount);
+    } mutex.unlock(); m_mixMutex.unlock();
+}
+
+void Synthesizer::setResampleQuality(Resampler::Quality quality) {
+    mutex.lock(); {
+        m_resampleQuality = quality;
+        retireResamplers();
+    } mutex.unlock();
+}
+
+SampleHandle Synthesizer::addSample(const shared_ptr<AudioSample>& audioSample) {
+    SampleHandle handle;
+    mutex.lock(); {
+        if (m_freeSlots.size() > 0) {
+            handle = m_freeSlots.pop();
+        } else {
+            handle = m_sampleTable.size();
+            m_sampleTable.next();
+        }
+        m_sampleTable[handle].sample   = audioSample;
+        m_sampleTable[handle].released = false;
+    } mutex.unlock();
+    return handle;
+}
+
+void Synthesizer::releaseSample(SampleHandle handle) {
+    mutex.lock(); {
+        debugAssertM(notNull(m_sampleTable[handle].sample) && ! m_sampleTable[handle].released, "Sample released twice");
+        m_sampleTable[handle].released = true;
+        m_reclaimPending = true;
+    } mutex.unlock();
+}
+
+void Synthesizer::reserveVoices() {
+    const int sounds = m_playingSounds + m_queuedSounds.size();
+    const int tones  = m_playingTones + m_queuedTones.size();
+    if ((sounds <= m_soundCapacity) && (tones <= m_toneCapacity)) {
+        return;
+    }
+    // Doubling, so this happens a handful of times however many voices play
+    m_soundCapacity = max(m_soundCapacity, int(ceilPow2(unsigned(max(sounds, 64)))));
+    m_toneCapacity  = max(m_toneCapacity,  int(ceilPow2(unsigned(max(tones, 64)))));
+
+    // Empty, with room to append up to the capacity
+    m_grownSounds.fastClear();
+    m_grownSounds.resize(m_soundCapacity);
+    m_grownSounds.fastClear();
+    m_grownTones.fastClear();
+    m_grownTones.resize(m_toneCapacity);
+    m_grownTones.fastClear();
+    m_grownFinished.resize(m_soundCapacity + m_toneCapacity);
+    m_voicesGrown = true;
+}
+
+void Synthesizer::queueSound(SampleHandle handle, int delay, const Envelope& envelope, float position) {
+    mutex.lock(); {
+        SampleSlot& slot = m_sampleTable[handle];
+        debugAssertM(! slot.released, "Queued a released sample");
+        ++slot.voices;
+        const AudioSample* audioSample = slot.sample.get();
+        m_queuedSounds.append(SoundInstance(handle, audioSample, -delay, acquireResampler(audioSample->sampleRate), envelope, m_sampleRate, 
+                                            ChannelPan(position, m_channelCount)));
+        reserveVoices();
+    } mutex.unlock();
+}
+
+void Synthesizer::queueSound(const shared_ptr<AudioSample>& audioSample, int delay, const Envelope& envelope, float position) {
+    const SampleHandle handle = addSample(audioSample);
+    queueSound(handle, delay, envelope, position);
+    releaseSample(handle);
+}
+
+
+void Synthesizer::queueTone(const Tone& tone, const Envelope& envelope, int delay, float position) {
+    alwaysAssertM(envelope.isFinite(), "A tone needs an envelope that ends");
+    mutex.lock(); {
+        if (notNull(tone.wavetable)) {
+            int t = ownerIndex(m_wavetables, tone.wavetable.get());
+            if (t == -1) {
+                // Only the first note on each table takes a reference. A new
+                // table may mean its owner dropped an old one
+                t = m_wavetables.size();
+                m_wavetables.append(VoiceOwner<Wavetable>(tone.wavetable));
+                m_reclaimPending = true;
+            }
+            ++m_wavetables[t].voices;
+        }
+        m_queuedTones.append(ToneInstance(tone, envelope, m_sampleRate, -delay, ChannelPan(position, m_channelCount)));
+        reserveVoices();
+    } mutex.unlock();
+}
+
+
+void Synthesizer::mixVoices(int begin, int end, Sample* output, Array<Sample>& voiceBuffer, int frameCount) {
+    // Within the room allocateMixBuffers() made, so this never reallocates
+    voiceBuffer.resize(frameCount, false);
+    Sample* voice = voiceBuffer.getCArray();
+    const int soundCount = m_sounds.size();
+    for (int v = begin; v < end; ++v) {
+        System::memset(voice, 0, sizeof(Sample) * frameCount);
+        if (v < soundCount) {
+            SoundInstance& sound = m_sounds[v];
+            m_finished[v] = sound.play(voiceBuffer);
+            panMix(output, voice, frameCount, m_channelCount, sound.pan);
+        } else {
+            ToneInstance& tone = m_tones[v - soundCount];
+            m_finished[v] = tone.play(voiceBuffer);
+            panMix(output, voice, frameCount, m_channelCount, tone.pan);
+        }
+    }
+}
+
+void Synthesizer::mixPartition(void* synthesizer, int participant) {
+    Synthesizer* s = (Synthesizer*)synthesizer;
+    const int voiceCount = s->m_sounds.size() + s->m_tones.size();
+    const int participants = s->m_mixerPool->participantCount();
+    // Fixed contiguous ranges, so each voice always lands in the same sub-mix
+    const int begin = int(int64(voiceCount) * participant / participants);
+    const int end   = int(int64(voiceCount) * (participant + 1) / participants);
+
+    Sample* output = s->m_mixOutput;
+    if (participant > 0) {
+        Array<Sample>& subMix = s->m_subMixes[participant];
+        // Within the room allocateMixBuffers() made, so this never reallocates
+        subMix.resize(s->m_mixFrameCount * s->m_channelCount, false);
+        output = subMix.getCArray();
+        System::memset(output, 0, sizeof(Sample) * subMix.size());
+    }
+    s->mixVoices(begin, end, output, s->m_voiceBuffers[participant], s->m_mixFrameCount);
+}
+
+/** Counts off a finished voice on \a p, if any of \a owners holds it. Returns
+    true if that left it with none */
+template<class T>
+static bool releaseVoice(Array<T>& owners, const void* p) {
+    const int i = ownerIndex(owners, p);
+    return (i != -1) && (--owners[i].voices == 0);
+}
+
+void Synthesizer::updateVoices() {
     mutex.lock(); {
-        m_sounds.append(SoundInstance(audioSample, -delay));
+        // Voices only finish here, so the counts the mix left are complete
+        const int soundCount = m_sounds.size();
+        int kept = 0;
+        for (int v = 0; v < soundCount; ++v) {
+            const SoundInstance& sound = m_sounds[v];
+            if (m_finished[v]) {
+                SampleSlot& slot = m_sampleTable[sound.handle];
+                if ((--slot.voices == 0) && slot.released) {
+                    m_reclaimPending = true;
+                }
+                // A resampler is in one of the two; only retired ones are freed
+                if (notNull(sound.resampler) && ! releaseVoice(m_resamplers, sound.resampler) &&
+                    releaseVoice(m_retiredResamplers, sound.resampler)) {
+                    m_reclaimPending = true;
+                }
+            } else {
+                if (kept != v) {
+                    m_sounds[kept] = sound;
+                }
+                ++kept;
+            }
+        }
+        m_sounds.resize(kept, false);
+        kept = 0;
+        for (int t = 0; t < m_tones.size(); ++t) {
+            const ToneInstance& tone = m_tones[t];
+            if (m_finished[soundCount + t]) {
+                if (notNull(tone.wavetable) && releaseVoice(m_wavetables, tone.wavetable)) {
+                    m_reclaimPending = true;
+                }
+            } else {
+                if (kept != t) {
+                    m_tones[kept] = tone;
+                }
+                ++kept;
+            }
+        }
+        m_tones.resize(kept, false);
+
+        if (m_voicesGrown) {
+            // Made with room for every voice, so appending does not allocate
+            for (const SoundInstance& sound : m_sounds) {
+                m_grownSounds.append(sound);
+            }
+            for (const ToneInstance& tone : m_tones) {
+                m_grownTones.append(tone);
+            }
+            m_sounds.swap(m_grownSounds);
+            m_tones.swap(m_grownTones);
+            m_finished.swap(m_grownFinished);
+            m_voicesGrown    = false;
+            m_reclaimPending = true;
+        }
+
+        // reserveVoices() left room for these
+        for (const SoundInstance& sound : m_queuedSounds) {
+            m_sounds.append(sound);
+        }
+        for (const ToneInstance& tone : m_queuedTones) {
+            m_tones.append(tone);
+        }
+        m_queuedSounds.fastClear();
+        m_queuedTones.fastClear();
+        m_playingSounds = m_sounds.size();
+        m_playingTones  = m_tones.size();
     } mutex.unlock();
 }
 
+void Synthesizer::synthesize(Sample* output, int frameCount) {
+    m_mixMutex.lock(); {
+        for (int f = 0; f < frameCount; f += m_maxFrameCount) {
+            synthesizeBlock(output + f * m_channelCount, min(m_maxFrameCount, frameCount - f));
+        }
+    } m_mixMutex.unlock();
+}
 
-void Synthesizer::synthesize(Array<Sample>& samples) {
+void Synthesizer::synthesizeBlock(Sample* output, int frameCount) {
+    // The only time the audio thread takes mutex
+    updateVoices();
+
+    System::memset(output, 0, sizeof(Sample) * frameCount * m_channelCount);
+    const int voiceCount = m_sounds.size() + m_tones.size();
+    if (notNull(m_mixerPool) && (voiceCount >= PARALLEL_VOICE_THRESHOLD)) {
+        m_mixOutput     = output;
+        m_mixFrameCount = frameCount;
+        m_mixerPool->run(&Synthesizer::mixPartition, this);
+        for (int p = 1; p < m_mixerPool->participantCount(); ++p) {
+            addSamples(output, m_subMixes[p].getCArray(), frameCount * m_channelCount);
+        }
+    } else {
+        mixVoices(0, voiceCount, output, m_voiceBuffers[0], frameCount);
+    }
+
+    m_delay.process(output, frameCount);
+    if (notNull(m_reverb)) {
+        m_reverb->process(output, frameCount, m_channelCount);
+    }
+    m_masterBus.process(output, frameCount);
+    m_analyzer.capture(output, frameCount, m_channelCount);
+    // Only this thread writes it
+    sampleCount.store(sampleCount.load() + double(frameCount));
+}
+
+void Synthesizer::reclaim() {
+    if (! m_reclaimPending.exchange(false)) {
+        return;
+    }
+    // Dropped when these go out of scope, outside the lock
+    Array<shared_ptr<AudioSample>> freed;
+    Array<shared_ptr<Resampler>> freedResamplers;
+    Array<shared_ptr<Wavetable>> freedTables;
+    Array<SoundInstance> outgrownSounds;
+    Array<ToneInstance> outgrownTones;
+    Array<uint8> outgrownFinished;
     mutex.lock(); {
-        int maxIndex = m_sounds.size() - 1;
-        for (int i = maxIndex; i >= 0; --i) {
-            if (m_sounds[i].play(samples)) {
-                m_sounds.remove(i);
+        for (int h = 0; h < m_sampleTable.size(); ++h) {
+            SampleSlot& slot = m_sampleTable[h];
+            if (slot.released && (slot.voices == 0)) {
+                freed.append(slot.sample);
+                slot.sample.reset();
+                slot.released = false;
+                m_freeSlots.append(h);
+            }
+        }
+
+        for (int r = m_retiredResamplers.size() - 1; r >= 0; --r) {
+            if (m_retiredResamplers[r].voices == 0) {
+                freedResamplers.append(m_retiredResamplers[r].object);
+                m_retiredResamplers.fastRemove(r);
+            }
+        }
+
+        for (int t = m_wavetables.size() - 1; t >= 0; --t) {
+            // Still owned elsewhere, so more notes may be queued on it
+            if ((m_wavetables[t].voices == 0) && (m_wavetables[t].object.use_count() == 1)) {
+                freedTables.append(m_wavetables[t].object);
+                m_wavetables.fastRemove(t);
             }
         }
-        sampleCount += double(samples.size());
+
+        if (! m_voicesGrown) {
+            // What the audio thread swapped out when it took the grown arrays
+            outgrownSounds.swap(m_grownSounds);
+            outgrownTones.swap(m_grownTones);
+            outgrownFinished.swap(m_grownFinished);
+        }
     } mutex.unlock();
-}
\ No newline at end of file
+}
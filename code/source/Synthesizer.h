@@ -2,27 +2,86 @@
 #define Synthesizer_h
 #include<G3D/G3DAll.h>
 #include "AudioSample.h"
+#include "Resampler.h"
+#include "Wavetable.h"
+#include "Envelope.h"
+#include "MasterBus.h"
+#include "MixerPool.h"
+#include "SpectrumAnalyzer.h"
+#include "ConvolutionReverb.h"
+#include "TempoDelay.h"
+#include <atomic>
 #include <mutex>
+
+/** Index of a sample registered with Synthesizer::addSample */
+typedef int SampleHandle;
+
+/** 
+    Where a voice sits among the output channels, which are treated as evenly
+    spaced along a line from the first to the last. A voice feeds the two
+    channels around its position with constant-power gains, computed once
+    when it is queued.
+ */
+struct ChannelPan {
+    /** Lower of the two channels fed */
+    int channel;
+    /** For channel and channel + 1 */
+    float gain[2];
+
+    ChannelPan() : channel(0) {
+        gain[0] = 1.0f;
+        gain[1] = 0.0f;
+    }
+
+    /** \a position in [0, 1] runs from the first channel to the last */
+    ChannelPan(float position, int channelCount);
+};
+
 struct SoundInstance {
-    shared_ptr<AudioSample> audioSample;
+    /** Slot in the Synthesizer's sample table, which stays alive while this plays */
+    SampleHandle handle;
+    /** Owned by that slot */
+    const AudioSample* audioSample;
+    /** Converts audioSample to the output rate. Null when the rates already
+        match. Owned by the Synthesizer, which keeps it while this plays */
+    const Resampler* resampler;
+    /** In output samples. Negative while the sound is still delayed */
     int currentPosition;
-    /** Returns true if finished */
-    bool play(Array<float>& buffer) {
-        // TODO: double check this
-        for (int i = 0; i < buffer.size(); ++i) {
-            if (currentPosition >= 0) {
-                buffer[i] += audioSample->buffer[currentPosition];
-            }
-            ++currentPosition;
-            if (currentPosition == audioSample->sampleCount()) {
-                return true;
-            }
-        }
-        return false;
-    }
+    /** Read position in audioSample's own samples. Only used with a resampler */
+    double sourcePosition;
+    /** False for pass-through envelopes, which skip the envelope entirely */
+    bool shaped;
+    EnvelopeGenerator envelope;
+    ChannelPan pan;
+    /** Mixes into a mono buffer. Returns true if finished */
+    bool play(Array<float>& buffer);
     SoundInstance() {}
-    SoundInstance(const shared_ptr<AudioSample>& audioSample, int currentPosition) :
-        audioSample(audioSample), currentPosition(currentPosition) {}
+    SoundInstance(SampleHandle handle, const AudioSample* audioSample, int currentPosition, const Resampler* resampler, 
+                  const Envelope& envelope, int sampleRate, const ChannelPan& pan) :
+        handle(handle), audioSample(audioSample), resampler(resampler), currentPosition(currentPosition), sourcePosition(0.0),
+        shaped(!envelope.isPassThrough()), envelope(envelope, sampleRate), pan(pan) {}
+};
+
+/** A playing Tone: a 32-bit phase accumulator reading a shared band-limited
+    table, or driving an Oscillator */
+struct ToneInstance {
+    /** Owner of table. The Synthesizer keeps it while this plays */
+    const Wavetable* wavetable;
+    /** Null for oscillator tones */
+    const Wavetable::Level* table;
+    Oscillator::Shape shape;
+    /** Top Wavetable::TABLE_BITS bits index the table, the rest interpolate */
+    uint32 phase;
+    uint32 phaseIncrement;
+    /** In output samples. Negative while the tone is still delayed */
+    int currentPosition;
+    float volume;
+    EnvelopeGenerator envelope;
+    ChannelPan pan;
+    /** Mixes into a mono buffer. Returns true if finished */
+    bool play(Array<float>& buffer);
+    ToneInstance() {}
+    ToneInstance(const Tone& tone, const Envelope& envelope, int sampleRate, int currentPosition, const ChannelPan& pan);
 };
 
 class Synthesizer {
@@ -30,24 +89,270 @@ public:
     
     static shared_ptr<Synthesizer> global;
 private:
+    /** 
+      Guards the sample table, the owners of what voices point to, and the
+      queued voices. Held only briefly: the audio thread takes it once per
+      callback to retire finished voices and take in queued ones, and never
+      waits on it for longer than another thread's queueSound(), queueTone()
+      or reclaim() takes.
+     */
     std::mutex mutex;
+
+    /** Held by the audio thread while it mixes. Only the setters of the
+        output format and effects take it, which happens while setting up
+        the stream. Always taken before mutex */
+    std::mutex m_mixMutex;
+
+    struct SampleSlot {
+        /** Null while the slot is free */
+        shared_ptr<AudioSample> sample;
+        /** Sounds queued or playing this slot */
+        int voices;
+        /** Set by releaseSample; the slot is freed once voices reaches 0 */
+        bool released;
+        SampleSlot() : voices(0), released(false) {}
+    };
+    /** 
+      Indexed by SampleHandle. Voices only keep a handle and a raw pointer,
+      so starting and finishing a sound never touches a reference count, and
+      the last reference to a sample is only ever dropped in reclaim().
+     */
+    Array<SampleSlot> m_sampleTable;
+    Array<SampleHandle> m_freeSlots;
+
+    /** Keeps an object that voices hold raw pointers to alive while they play */
+    template<class T>
+    struct VoiceOwner {
+        shared_ptr<T> object;
+        /** Voices queued or playing with object */
+        int voices;
+        VoiceOwner() : voices(0) {}
+        explicit VoiceOwner(const shared_ptr<T>& object) : object(object), voices(0) {}
+    };
+
+    /** Playing voices. Only the audio thread touches these */
     Array<SoundInstance> m_sounds;
-    double sampleCount;
+    Array<ToneInstance> m_tones;
+    /** Indexed like mixVoices; set for voices that finished this callback */
+    Array<uint8> m_finished;
+
+    /** Voices queued since the audio thread last took them in. Under mutex */
+    Array<SoundInstance> m_queuedSounds;
+    Array<ToneInstance> m_queuedTones;
+    /** m_sounds.size() and m_tones.size() as of the audio thread taking in
+        the queued voices. They only shrink until it next does. Under mutex */
+    int m_playingSounds;
+    int m_playingTones;
+    /** Room in m_sounds and m_tones, or in the grown arrays once taken in.
+        Kept at least the playing plus queued voices, so taking them in
+        never allocates. Under mutex */
+    int m_soundCapacity;
+    int m_toneCapacity;
+    /** 
+      Larger arrays made under mutex for the audio thread, which copies its
+      voices in and swaps them with its own when m_voicesGrown is set. The
+      old ones are left here for reclaim() to free.
+     */
+    Array<SoundInstance> m_grownSounds;
+    Array<ToneInstance> m_grownTones;
+    Array<uint8> m_grownFinished;
+    bool m_voicesGrown;
+    /** Set when reclaim() may have something to free */
+    std::atomic<bool> m_reclaimPending;
+
+    /** Frames synthesized so far. Written by the audio thread and read from
+        others, so atomic rather than under mutex */
+    std::atomic<double> sampleCount;
+    /** Only touched by tick(), which has a single caller */
     double lastSampleCount;
+
+    /** Output (stream) rate in Hz */
+    int m_sampleRate;
+    /** Interleaved channels in the output */
+    int m_channelCount;
+    /** Most frames mixed at once; longer callbacks are mixed in blocks of this */
+    int m_maxFrameCount;
+    /** Null unless parallel mixing is enabled */
+    shared_ptr<MixerPool> m_mixerPool;
+    /** Per mixing participant. Each voice renders into its participant's
+        mono buffer before being panned into the output */
+    Array<Array<Sample>> m_voiceBuffers;
+    /** Per mixing participant after the first, which mixes straight into
+        the output. Summed into the output in order, so results do not
+        depend on thread timing */
+    Array<Array<Sample>> m_subMixes;
+    /** The callback being mixed in parallel */
+    Sample* m_mixOutput;
+    int m_mixFrameCount;
+    Resampler::Quality m_resampleQuality;
+    /** One per input rate seen so far, all converting to m_sampleRate */
+    Array<VoiceOwner<Resampler>> m_resamplers;
+    /** Replaced by a change of rate or quality. Dropped in reclaim() once
+        no sound uses them */
+    Array<VoiceOwner<Resampler>> m_retiredResamplers;
+    /** 
+      Every table a queued or playing tone may read. Tones only keep raw
+      pointers, so the owner of a table can drop it while it plays; the
+      last reference is then dropped in reclaim() once no tone uses it.
+     */
+    Array<VoiceOwner<Wavetable>> m_wavetables;
+
+    /** Only processed on the audio thread, ahead of the reverb */
+    TempoDelay m_delay;
+
+    /** Optional; processed on the audio thread, ahead of the master bus */
+    shared_ptr<ConvolutionReverb> m_reverb;
+
+    /** Only processed on the audio thread */
+    MasterBus m_masterBus;
+
+    /** Captures the final mix */
+    SpectrumAnalyzer m_analyzer;
+
+    /** Returns null if no conversion is needed, and otherwise counts a
+        voice on the resampler returned. Call with mutex held */
+    const Resampler* acquireResampler(int inputRate);
+
+    /** Moves m_resamplers to m_retiredResamplers. Call with mutex held */
+    void retireResamplers();
+
+    /** Makes the grown arrays if the queued voices would not fit in the
+        audio thread's. Call with mutex held */
+    void reserveVoices();
+
+    /** Audio thread: retires the voices that finished in the last callback
+        and takes in the queued ones. Takes mutex */
+    void updateVoices();
+
+    /** Gives every mix buffer room for m_maxFrameCount frames, so the audio
+        thread never grows one. Call with m_mixMutex held */
+    void allocateMixBuffers();
+
+    /** Mixes at most m_maxFrameCount frames. Call with m_mixMutex held */
+    void synthesizeBlock(Sample* output, int frameCount);
+
+    /** 
+      Renders voices [begin, end), numbering m_sounds first and then m_tones,
+      adding them into \a output. Only touches those voices, their
+      m_finished entries and \a voiceBuffer, so disjoint ranges can run
+      concurrently. Audio thread and mixing workers only.
+     */
+    void mixVoices(int begin, int end, Sample* output, Array<Sample>& voiceBuffer, int frameCount);
+
+    /** MixerPool job: mixes \a participant's share of the voices */
+    static void mixPartition(void* synthesizer, int participant);
 public:
-    Synthesizer() : sampleCount(0.0), lastSampleCount(0.0) {}
-    void queueSound(shared_ptr<AudioSample> audioSample, int delay = 0);
+    Synthesizer() : m_playingSounds(0), m_playingTones(0), m_soundCapacity(0), m_toneCapacity(0), m_voicesGrown(false), m_reclaimPending(false),
+        sampleCount(0.0), lastSampleCount(0.0), m_sampleRate(48000), m_channelCount(1), m_maxFrameCount(512), m_mixOutput(NULL), m_mixFrameCount(0), m_resampleQuality(Resampler::Quality::STANDARD) {
+        allocateMixBuffers();
+    }
+    /** Registers \a audioSample for queueSound. It must not be modified while registered */
+    SampleHandle addSample(const shared_ptr<AudioSample>& audioSample);
+
+    /** The handle must not be queued again. The sample is dropped in a later
+        reclaim() once every sound playing it has finished */
+    void releaseSample(SampleHandle handle);
+
+    /** The sound ends when either the sample or the envelope does. \a position
+        pans it across the output channels, as in ChannelPan */
+    void queueSound(SampleHandle handle, int delay = 0, const Envelope& envelope = Envelope(), float position = 0.5f);
+
+    /** Plays a sample without keeping it registered. Prefer handles for
+        anything played more than once */
+    void queueSound(const shared_ptr<AudioSample>& audioSample, int delay = 0, const Envelope& envelope = Envelope(), float position = 0.5f);
+
+    /** Plays \a tone on a wavetable voice, rendered as it plays. The tone
+        ends with \a envelope, which must be finite */
+    void queueTone(const Tone& tone, const Envelope& envelope, int delay = 0, float position = 0.5f);
+
+    /** Must match the rate the audio stream was opened with. Samples of any
+        other rate are resampled on the fly while they play. */
+    void setSampleRate(int sampleRate);
+
+    int sampleRate() const {
+        return m_sampleRate;
+    }
+
+    /** Must match the channel count the audio stream was opened with. Pans
+        of sounds already playing are kept */
+    void setChannelCount(int channelCount);
+
+    int channelCount() const {
+        return m_channelCount;
+    }
+
+    /** Should match the buffer size the audio stream was opened with. Longer
+        callbacks still work, mixed in several blocks */
+    void setBufferFrameCount(int frameCount);
+
+    int bufferFrameCount() const {
+        return m_maxFrameCount;
+    }
+
+    /** Splits mixing across \a threadCount threads, including the audio
+        thread, when many voices are playing. 1 mixes everything on the
+        audio thread, which is the default */
+    void setMixThreadCount(int threadCount);
 
+    int mixThreadCount() const {
+        return isNull(m_mixerPool) ? 1 : m_mixerPool->participantCount();
+    }
+
+    /** Applies to sounds queued after the call; playing sounds keep their filter */
+    void setResampleQuality(Resampler::Quality quality);
+
+    Resampler::Quality resampleQuality() const {
+        return m_resampleQuality;
+    }
+
+    /** Echoes of the mix, in time with the sequencer. The settings may be
+        changed from any thread */
+    TempoDelay& delay() {
+        return m_delay;
+    }
+
+    /** Adds \a reverb to the mix before the master bus, or removes it if
+        null. The reverb must have been created at sampleRate() */
+    void setReverb(const shared_ptr<ConvolutionReverb>& reverb);
+
+    /** Null if there is none. Only its wet level may be changed while it is set */
+    const shared_ptr<ConvolutionReverb>& reverb() const {
+        return m_reverb;
+    }
+
+    /** Gain, limiter and meters applied to the whole mix. The settings and
+        meters may be used from any thread */
+    MasterBus& masterBus() {
+        return m_masterBus;
+    }
+
+    /** Spectrum and waveform of the output, after the master bus. Call
+        update() on it from the thread that draws */
+    SpectrumAnalyzer& analyzer() {
+        return m_analyzer;
+    }
+
+    /** Safe from any thread */
     double currentSampleCount() const {
-        return sampleCount;
+        return sampleCount.load();
     }
 
+    /** Frames synthesized since the last call. Call from one thread only */
     double tick() {
-        double result = sampleCount - lastSampleCount;
-        lastSampleCount = sampleCount;
+        const double now = sampleCount.load();
+        const double result = now - lastSampleCount;
+        lastSampleCount = now;
         return result;
     }
 
-    void synthesize(Array<float>& samples);
+    /** Overwrites \a frameCount frames of channelCount() interleaved samples */
+    void synthesize(Sample* output, int frameCount);
+
+    /** Frees released samples, replaced resamplers and tables that no voice
+        is playing anymore, and voice arrays that were outgrown. Returns at
+        once unless something may need freeing, so it is cheap to call
+        regularly. Call from a thread other than the audio thread, since
+        this may free their buffers */
+    void reclaim();
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,139 @@
+#include "TempoDelay.h"
+
+static const float DEFAULT_BPM      = 150.0f;
+/** A dotted quarter note */
+static const float DEFAULT_STEPS    = 3.0f;
+static const float DEFAULT_FEEDBACK = 0.35f;
+static const float DEFAULT_WET      = 0.0f;
+
+/** Keeps the echoes decaying however the setting is pushed */
+static const float MAX_FEEDBACK     = 0.95f;
+
+/** Seconds for a change of delay to glide most of the way */
+static const double GLIDE_TIME      = 0.1;
+/** Fastest the delay may change, in frames per frame. Caps the pitch shift
+    of the echoes while gliding at a quarter */
+static const double MAX_GLIDE_SLOPE = 0.25;
+
+TempoDelay::TempoDelay(int sampleRate, int channelCount) :
+        m_bpm(DEFAULT_BPM),
+        m_steps(DEFAULT_STEPS),
+        m_feedback(DEFAULT_FEEDBACK),
+        m_wet(DEFAULT_WET) {
+    m_dry.resize(BLOCK_SIZE);
+    m_delayed.resize(BLOCK_SIZE);
+    setFormat(sampleRate, channelCount);
+}
+
+void TempoDelay::setFormat(int sampleRate, int channelCount) {
+    alwaysAssertM(channelCount > 0, "Need at least one channel");
+    m_sampleRate   = sampleRate;
+    m_channelCount = channelCount;
+
+    // A step is half a beat
+    const int longest = iCeil(double(MAX_STEPS) * 30.0 / double(MIN_BPM) * double(sampleRate));
+    m_capacity = ceilPow2(unsigned(longest + BLOCK_SIZE + 2));
+
+    m_ring.resize(channelCount * (m_capacity + GUARD));
+    System::memset(m_ring.getCArray(), 0, sizeof(Sample) * m_ring.size());
+    m_writeIndex = 0;
+
+    m_glideCoefficient = 1.0 - exp(-double(BLOCK_SIZE) / (GLIDE_TIME * double(sampleRate)));
+    m_delay = targetDelay();
+}
+
+double TempoDelay::targetDelay() const {
+    const double bpm   = max(double(m_bpm.load(std::memory_order_relaxed)), double(MIN_BPM));
+    const double steps = clamp(double(m_steps.load(std::memory_order_relaxed)), 0.0, double(MAX_STEPS));
+    // Reads stay behind the block being written and ahead of the oldest
+    // frame that block overwrites
+    return clamp(steps * 30.0 / bpm * double(m_sampleRate), double(BLOCK_SIZE + 1), double(m_capacity - BLOCK_SIZE - 2));
+}
+
+/** out[i] = a[i] + (b[i] - a[i]) * t */
+static void interpolate(Sample* out, const Sample* a, const Sample* b, int n, float t) {
+    int i = 0;
+#   ifdef SUBSTEP_SSE
+        const __m128 t4 = _mm_set1_ps(t);
+        for (; i + 4 <= n; i += 4) {
+            const __m128 a4 = _mm_loadu_ps(a + i);
+            _mm_storeu_ps(out + i, _mm_add_ps(a4, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(b + i), a4), t4)));
+        }
+#   endif
+    for (; i < n; ++i) {
+        out[i] = a[i] + (b[i] - a[i]) * t;
+    }
+}
+
+/** dry[i] += delayed[i] * feedback, turning the dry input into what is written back */
+static void addFeedback(Sample* dry, const Sample* delayed, int n, float feedback) {
+    int i = 0;
+#   ifdef SUBSTEP_SSE
+        const __m128 f = _mm_set1_ps(feedback);
+        for (; i + 4 <= n; i += 4) {
+            _mm_storeu_ps(dry + i, _mm_add_ps(_mm_loadu_ps(dry + i), _mm_mul_ps(_mm_loadu_ps(delayed + i), f)));
+        }
+#   endif
+    for (; i < n; ++i) {
+        dry[i] += delayed[i] * feedback;
+    }
+}
+
+void TempoDelay::process(Sample* samples, int frameCount) {
+    const float  feedback = clamp(m_feedback.load(std::memory_order_relaxed), 0.0f, MAX_FEEDBACK);
+    const float  wet      = m_wet.load(std::memory_order_relaxed);
+    const double target   = targetDelay();
+    const uint32 mask     = uint32(m_capacity - 1);
+    const int    stride   = m_capacity + GUARD;
+
+    for (int start = 0; start < frameCount; start += BLOCK_SIZE) {
+        const int n = min(BLOCK_SIZE, frameCount - start);
+        Sample* frames = samples + start * m_channelCount;
+
+        // Glide linearly across the block toward where the one-pole
+        // smoother says the delay should be at its end
+        const double limit = MAX_GLIDE_SLOPE * double(n);
+        double end = m_delay + clamp((target - m_delay) * m_glideCoefficient * double(n) / double(BLOCK_SIZE), -limit, limit);
+        if (abs(target - end) < 1e-3) {
+            end = target;
+        }
+        const double slope = (end - m_delay) / double(n);
+
+        for (int c = 0; c < m_channelCount; ++c) {
+            Sample* ring = m_ring.getCArray() + c * stride;
+
+            if (slope == 0.0) {
+                // Frame i reads between frames w + i - whole - 1 and w + i - whole
+                const int    whole = int(floor(m_delay));
+                const float  t     = float(1.0 - (m_delay - double(whole)));
+                const Sample* a    = ring + ((m_writeIndex - uint32(whole) - 1) & mask);
+                interpolate(m_delayed.getCArray(), a, a + 1, n, t);
+            } else {
+                for (int i = 0; i < n; ++i) {
+                    const double position = double(i) - (m_delay + slope * double(i));
+                    const double below    = floor(position);
+                    const float  t        = float(position - below);
+                    const uint32 index    = (m_writeIndex + uint32(int32(below))) & mask;
+                    m_delayed[i] = ring[index] + (ring[index + 1] - ring[index]) * t;
+                }
+            }
+
+            for (int i = 0; i < n; ++i) {
+                m_dry[i] = frames[i * m_channelCount + c];
+                frames[i * m_channelCount + c] += m_delayed[i] * wet;
+            }
+            addFeedback(m_dry.getCArray(), m_delayed.getCArray(), n, feedback);
+
+            for (int i = 0; i < n; ++i) {
+                const uint32 index = (m_writeIndex + uint32(i)) & mask;
+                ring[index] = m_dry[i];
+                if (index < uint32(GUARD)) {
+                    ring[m_capacity + index] = m_dry[i];
+                }
+            }
+        }
+
+        m_writeIndex += uint32(n);
+        m_delay = end;
+    }
+}
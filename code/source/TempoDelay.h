@@ -0,0 +1,108 @@
+#ifndef TempoDelay_h
+#define TempoDelay_h
+#include <G3D/G3DAll.h>
+#include <atomic>
+#include "util.h"
+
+/**
+    Feedback delay whose time is a number of sequencer steps at the current
+    tempo.
+
+    Each channel echoes itself through a ring sized at setFormat() for the
+    longest delay at MIN_BPM, so tempo changes never reallocate. When the
+    tempo or step count changes, the delay glides to the new length, reading
+    between samples with linear interpolation, instead of jumping and
+    clicking. Once it has settled the interpolation weights are the same for
+    a whole block, which lets the read run four samples at a time. The cost
+    of a buffer depends only on its length and the channel count.
+
+    process() must only be called from one thread at a time. The settings are
+    atomics, so any thread may adjust them while it runs.
+ */
+class TempoDelay {
+public:
+    /** Slowest tempo the ring has room for; slower tempos are clamped */
+    static const int MIN_BPM        = 30;
+    /** Longest delay, in sequencer steps */
+    static const int MAX_STEPS      = 4;
+    /** Frames processed at a time. The delay is never shorter than this */
+    static const int BLOCK_SIZE     = 64;
+
+private:
+    /** Copies of the start of each channel's ring kept past its end, so that
+        a block can read across the wrap contiguously */
+    static const int GUARD          = BLOCK_SIZE + 1;
+
+    std::atomic<float>  m_bpm;
+    std::atomic<float>  m_steps;
+    std::atomic<float>  m_feedback;
+    std::atomic<float>  m_wet;
+
+    int     m_sampleRate;
+    int     m_channelCount;
+    /** Power of two frames per channel */
+    int     m_capacity;
+
+    /** m_channelCount rings of m_capacity + GUARD samples each */
+    Array<Sample> m_ring;
+    /** Total frames written. Only used masked, so wrapping around is harmless */
+    uint32  m_writeIndex;
+    /** Current delay in frames, gliding toward targetDelay() */
+    double  m_delay;
+    /** Fraction of the remaining glide covered per block */
+    double  m_glideCoefficient;
+
+    /** BLOCK_SIZE scratch */
+    Array<Sample> m_dry;
+    Array<Sample> m_delayed;
+
+    /** Delay in frames for the current settings, clamped to what the ring holds */
+    double targetDelay() const;
+
+public:
+    explicit TempoDelay(int sampleRate = 48000, int channelCount = 1);
+
+    /** Clears the ring. Allocates */
+    void setFormat(int sampleRate, int channelCount);
+
+    /** A step is half a beat, as in the sequencer */
+    void setTempo(float bpm) {
+        m_bpm.store(bpm, std::memory_order_relaxed);
+    }
+
+    float tempo() const {
+        return m_bpm.load(std::memory_order_relaxed);
+    }
+
+    /** Delay length in steps, up to MAX_STEPS; fractions are allowed */
+    void setSteps(float steps) {
+        m_steps.store(steps, std::memory_order_relaxed);
+    }
+
+    float steps() const {
+        return m_steps.load(std::memory_order_relaxed);
+    }
+
+    /** Fraction of each echo fed back into the next, below 1 */
+    void setFeedback(float f) {
+        m_feedback.store(f, std::memory_order_relaxed);
+    }
+
+    float feedback() const {
+        return m_feedback.load(std::memory_order_relaxed);
+    }
+
+    /** Gain of the echoes added to the mix; 0 leaves the mix unchanged */
+    void setWet(float w) {
+        m_wet.store(w, std::memory_order_relaxed);
+    }
+
+    float wet() const {
+        return m_wet.load(std::memory_order_relaxed);
+    }
+
+    /** Adds echoes to \a frameCount interleaved frames in place */
+    void process(Sample* samples, int frameCount);
+};
+
+#endif
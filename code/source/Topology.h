@@ -0,0 +1,163 @@
+#ifndef Topology_h
+#define Topology_h
+#include <G3D/G3DAll.h>
+#include "PlayHead.h"
+
+/**
+    How heads move over the board: a lattice, which says which way they
+    can face and how they turn, and what happens at its edges.
+    CellularAutomata::stepWith() is a template on a topology, so the tests
+    in its per-head loops compile down to table lookups for the one in use,
+    without a switch per head.
+
+    A lattice provides:
+
+    - DIRECTIONS: heads face Direction 0 to DIRECTIONS - 1.
+    - turn(d): where a head facing d faces after hitting another head.
+    - nearest(d): the closest of its directions to any Direction, for heads
+      carried over from another lattice.
+
+    An edge policy is a template on a lattice, inherits it, and provides:
+
+    - cell(position, width, height): index of the cell at position, in
+      [0, width * height). Positions that name the same cell get the same
+      index, so heads there collide.
+    - move(head, width, height): advances head one cell.
+    - edge(head, width, height, hit, wall): true if head has just reached an
+      edge it is moving into, which plays a note. Sets hit to where and wall
+      to the side of the board it lies on, and does whatever the topology
+      does there.
+ */
+
+/** Four directions, turning a quarter clockwise */
+struct SquareLattice {
+    static const int DIRECTIONS = 4;
+
+    static Direction turn(Direction d) {
+        static const Direction::Value TURN[] = {
+            Direction::RIGHT, Direction::LEFT, Direction::UP, Direction::DOWN, Direction::UP, Direction::DOWN };
+        return TURN[d];
+    }
+
+    static Direction nearest(Direction d) {
+        static const Direction::Value NEAREST[] = {
+            Direction::UP, Direction::DOWN, Direction::LEFT, Direction::RIGHT, Direction::LEFT, Direction::RIGHT };
+        return NEAREST[d];
+    }
+};
+
+/** Six directions, turning a sixth clockwise. Drawn on the square grid,
+    clockwise from UP is RIGHT, DOWN_RIGHT, DOWN, LEFT, UP_LEFT */
+struct HexLattice {
+    static const int DIRECTIONS = 6;
+
+    static Direction turn(Direction d) {
+        static const Direction::Value TURN[] = {
+            Direction::RIGHT, Direction::LEFT, Direction::UP_LEFT, Direction::DOWN_RIGHT, Direction::UP, Direction::DOWN };
+        return TURN[d];
+    }
+
+    static Direction nearest(Direction d) {
+        return d;
+    }
+};
+
+/** The side of the board a head moving by \a step along x (or y) reaches */
+inline Direction wallX(int step) {
+    return (step > 0) ? Direction::RIGHT : Direction::LEFT;
+}
+
+inline Direction wallY(int step) {
+    return (step > 0) ? Direction::UP : Direction::DOWN;
+}
+
+/** The board's edges are walls that turn heads back */
+template<class Lattice>
+struct WallTopology : public Lattice {
+    static int cell(const Vector2int16& p, int width, int) {
+        return p.y * width + p.x;
+    }
+
+    /** A head placed on an edge facing out stays put, and edge() turns it */
+    static void move(PlayHead& head, int width, int height) {
+        const int x = head.position.x + DIRECTION_X[head.direction];
+        const int y = head.position.y + DIRECTION_Y[head.direction];
+        if ((x >= 0) && (x < width) && (y >= 0) && (y < height)) {
+            head.position = Vector2int16(x, y);
+        }
+    }
+
+    static bool edge(PlayHead& head, int width, int height, Vector2int16& hit, Direction& wall) {
+        const int dx = DIRECTION_X[head.direction];
+        const int dy = DIRECTION_Y[head.direction];
+        const Vector2int16 p = head.position;
+        const bool atX = ((dx < 0) && (p.x == 0)) || ((dx > 0) && (p.x == width - 1));
+        const bool atY = ((dy < 0) && (p.y == 0)) || ((dy > 0) && (p.y == height - 1));
+        if (! (atX || atY)) {
+            return false;
+        }
+        // A head in a corner hits the side wall first
+        wall = atX ? wallX(dx) : wallY(dy);
+        hit  = p;
+        head.direction = opposite(head.direction);
+        return true;
+    }
+};
+
+/**
+    The board wraps around like the torus it is drawn on, where the first
+    and last grid lines are the same circle. There are width - 1 distinct
+    columns and height - 1 distinct rows; a head on the seam is stored on
+    the side it is leaving from, so it is always drawn moving into the
+    board.
+
+    Crossing the seam plays the note that hitting that wall would, panned
+    to the side the head reached.
+ */
+template<class Lattice>
+struct WrapTopology : public Lattice {
+    /** \a x + \a period if it is below 0, - \a period if it is above \a period */
+    static int wrap(int x, int period) {
+        x += period & -int(x < 0);
+        x -= period & -int(x > period);
+        return x;
+    }
+
+    /** 0 for the seam, whichever side \a x names it from */
+    static int canonical(int x, int period) {
+        return x - (period & -int(x == period));
+    }
+
+    static int cell(const Vector2int16& p, int width, int height) {
+        return canonical(p.y, height - 1) * width + canonical(p.x, width - 1);
+    }
+
+    static void move(PlayHead& head, int width, int height) {
+        head.position.x = wrap(head.position.x + DIRECTION_X[head.direction], width  - 1);
+        head.position.y = wrap(head.position.y + DIRECTION_Y[head.direction], height - 1);
+    }
+
+    static bool edge(PlayHead& head, int width, int height, Vector2int16& hit, Direction& wall) {
+        const int dx = DIRECTION_X[head.direction];
+        const int dy = DIRECTION_Y[head.direction];
+        Vector2int16& p = head.position;
+        const bool atX = (dx != 0) && (canonical(p.x, width  - 1) == 0);
+        const bool atY = (dy != 0) && (canonical(p.y, height - 1) == 0);
+        if (! (atX || atY)) {
+            return false;
+        }
+        wall = atX ? wallX(dx) : wallY(dy);
+        hit  = p;
+        if (atX) {
+            hit.x = (dx > 0) ? width - 1 : 0;
+            p.x   = (dx > 0) ? 0 : width - 1;
+        }
+        if (atY) {
+            hit.y = (dy > 0) ? height - 1 : 0;
+            p.y   = (dy > 0) ? 0 : height - 1;
+        }
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,47 @@
+#include "Wavetable.h"
+
+Wavetable::Wavetable(const Array<float>& harmonicAmplitudes) {
+    const int maxHarmonic = min(harmonicAmplitudes.size(), TABLE_SIZE / 2);
+    alwaysAssertM(maxHarmonic > 0, "A wavetable needs at least one harmonic");
+
+    // Level k holds harmonics 1..2^k. Stop at the first level that already
+    // contains every requested harmonic, so a sine is a single table.
+    for (int limit = 1; ; limit *= 2) {
+        Level& table = m_levels.next();
+        table.resize(TABLE_SIZE + 1);
+        const int numHarmonics = min(limit, maxHarmonic);
+        for (int i = 0; i < TABLE_SIZE; ++i) {
+            double v = 0.0;
+            for (int h = 1; h <= numHarmonics; ++h) {
+                // Reduce the phase index modulo the table before converting to
+                // radians so high harmonics keep full precision
+                const int index = (h * i) & (TABLE_SIZE - 1);
+                v += harmonicAmplitudes[h - 1] * sin(2.0 * pi() * index / TABLE_SIZE);
+            }
+            table[i] = float(v);
+        }
+        table[TABLE_SIZE] = table[0];
+        if (limit >= maxHarmonic) {
+            break;
+        }
+    }
+}
+
+shared_ptr<Wavetable> Wavetable::create(const Array<float>& harmonicAmplitudes) {
+    return shared_ptr<Wavetable>(new Wavetable(harmonicAmplitudes));
+}
+
+shared_ptr<Wavetable> Wavetable::sine() {
+    static shared_ptr<Wavetable> s = create(Array<float>(1.0f));
+    return s;
+}
+
+int Wavetable::levelIndex(double frequency, int sampleRate) const {
+    // Highest harmonic that fits below Nyquist at this pitch
+    const double fit = (0.5 * sampleRate) / max(frequency, 1e-3);
+    int index = 0;
+    while ((index + 1 < m_levels.size()) && (double(1 << (index + 1)) <= fit)) {
+        ++index;
+    }
+    return index;
+}
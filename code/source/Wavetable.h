@@ -0,0 +1,72 @@
+#ifndef Wavetable_h
+#define Wavetable_h
+#include <G3D/G3DAll.h>
+#include "util.h"
+#include "Oscillator.h"
+
+/**
+    One period of a periodic waveform, stored as a chain of band-limited
+    tables (one per octave) so that any pitch can be played without
+    aliasing and without rendering a buffer per note.
+
+    Level k holds at most 2^k harmonics; levelIndex(frequency, sampleRate)
+    picks the richest level whose highest harmonic stays below Nyquist.
+
+    Immutable after creation, so one table is shared by every voice.
+ */
+class Wavetable {
+public:
+    /** Samples per period. A power of two so the phase accumulator wraps for free */
+    static const int TABLE_BITS = 11;
+    static const int TABLE_SIZE = 1 << TABLE_BITS;
+
+    /** TABLE_SIZE + 1 samples; the last repeats the first so linear
+        interpolation never has to wrap */
+    typedef Array<float> Level;
+
+private:
+    Array<Level> m_levels;
+
+    explicit Wavetable(const Array<float>& harmonicAmplitudes);
+
+public:
+    /** \param harmonicAmplitudes Sine amplitude of harmonic i + 1. Harmonics
+        above TABLE_SIZE / 2 are ignored */
+    static shared_ptr<Wavetable> create(const Array<float>& harmonicAmplitudes);
+
+    /** Shared pure sine table */
+    static shared_ptr<Wavetable> sine();
+
+    int numLevels() const {
+        return m_levels.size();
+    }
+
+    const Level& level(int i) const {
+        return m_levels[i];
+    }
+
+    /** Index of the band-limited table to use for a tone at \a frequency Hz */
+    int levelIndex(double frequency, int sampleRate) const;
+};
+
+
+/** 
+    A note for a wavetable voice. Cheap to copy: the waveform is shared and
+    nothing is pre-rendered, so a bank of these costs O(table) memory. The
+    amplitude envelope is supplied separately when the tone is queued.
+ */
+struct Tone {
+    /** If null, the tone is an Oscillator of the given shape instead */
+    shared_ptr<Wavetable> wavetable;
+    Oscillator::Shape shape;
+    /** In Hz */
+    double frequency;
+    float volume;
+
+    Tone() : frequency(440.0), volume(1.0f) {}
+    Tone(const shared_ptr<Wavetable>& wavetable, double frequency, float volume = 1.0f) :
+        wavetable(wavetable), frequency(frequency), volume(volume) {}
+    Tone(Oscillator::Shape shape, double frequency, float volume = 1.0f) :
+        shape(shape), frequency(frequency), volume(volume) {}
+};
+#endif
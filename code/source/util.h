@@ -4,6 +4,13 @@
 
 typedef float Sample;
 
+/** Defined when SSE intrinsics can be used for the inner loops.
+    Everything that uses it also has a plain C++ fallback. */
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 1))
+#   define SUBSTEP_SSE 1
+#   include <xmmintrin.h>
+#endif
+
 //https://en.wikipedia.org/wiki/Piano_key_frequencies
 static double pianoKeyNumberToFrequency(int index) {
   alwaysAssertM(index > 0 && index <= 88, "Piano Key index needs to be in [1,88]");